@@ -0,0 +1,504 @@
+// Measures latency of a local file or block device and prints it as
+// PercentileTimeProcessor::Percentiles table, ready to be pasted into a model.
+//
+// Usage:
+//   calibrate <path> [options]
+//
+// Options:
+//   --qd N          queue depth (default 32)
+//   --bs BYTES      block size (default 4096)
+//   --size BYTES    size of the region to use, required to create a new file (default: whole file/device)
+//   --seconds S     duration of the measurement (default 10)
+//   --write         measure writes instead of reads, destroys the data!
+//   --engine NAME   aio (Linux native async I/O) or sync (a thread per in-flight request), default aio
+//   --buffered      don't use direct I/O
+//   --name NAME     name of the generated variable (default diskPercentilesUs)
+//
+// When direct or async I/O is not available, the tool falls back to buffered or sync I/O.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/aio_abi.h>
+#include <linux/fs.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t Alignment = 4096;
+
+// the points of the generated table
+const std::vector<double> OutputPercentiles = {
+    10, 20, 30, 40, 50, 60, 70, 80, 90, 95, 99, 99.5, 99.9, 99.95, 99.99, 99.999, 100
+};
+
+struct Options {
+    std::string Path;
+    size_t QueueDepth = 32;
+    size_t BlockSize = 4096;
+    uint64_t Size = 0;
+    double Seconds = 10;
+    bool Write = false;
+    std::string Engine = "aio";
+    bool Direct = true;
+    std::string Name = "diskPercentilesUs";
+};
+
+void PrintUsageAndExit(const char* program) {
+    fprintf(stderr,
+        "Usage: %s <path> [--qd N] [--bs BYTES] [--size BYTES] [--seconds S] [--write] "
+        "[--engine aio|sync] [--buffered] [--name NAME]\n", program);
+    exit(1);
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto nextValue = [&]() -> const char* {
+            if (i + 1 >= argc) {
+                PrintUsageAndExit(argv[0]);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--qd") {
+            options.QueueDepth = std::stoul(nextValue());
+        } else if (arg == "--bs") {
+            options.BlockSize = std::stoul(nextValue());
+        } else if (arg == "--size") {
+            options.Size = std::stoull(nextValue());
+        } else if (arg == "--seconds") {
+            options.Seconds = std::stod(nextValue());
+        } else if (arg == "--write") {
+            options.Write = true;
+        } else if (arg == "--engine") {
+            options.Engine = nextValue();
+        } else if (arg == "--buffered") {
+            options.Direct = false;
+        } else if (arg == "--name") {
+            options.Name = nextValue();
+        } else if (!arg.empty() && arg[0] != '-' && options.Path.empty()) {
+            options.Path = arg;
+        } else {
+            PrintUsageAndExit(argv[0]);
+        }
+    }
+
+    if (options.Path.empty() || options.QueueDepth == 0 || options.BlockSize == 0 || options.Seconds <= 0) {
+        PrintUsageAndExit(argv[0]);
+    }
+
+    if (options.Engine != "aio" && options.Engine != "sync") {
+        PrintUsageAndExit(argv[0]);
+    }
+
+    if (options.Direct && options.BlockSize % Alignment != 0) {
+        throw std::runtime_error("Block size must be a multiple of 4096 for direct I/O");
+    }
+
+    return options;
+}
+
+// ----------------------------
+// Device: opened file or block device
+
+class Device {
+public:
+    Device(Options& options) {
+        int flags = options.Write ? O_RDWR : O_RDONLY;
+
+        struct stat st;
+        bool exists = stat(options.Path.c_str(), &st) == 0;
+        if (!exists) {
+            if (options.Size == 0) {
+                throw std::runtime_error("File doesn't exist, specify --size to create it");
+            }
+            Create(options.Path, options.Size);
+        }
+
+        if (options.Direct) {
+#ifdef O_DIRECT
+            Fd = open(options.Path.c_str(), flags | O_DIRECT);
+            if (Fd < 0 && errno == EINVAL) {
+                fprintf(stderr, "Direct I/O is not supported by %s, falling back to buffered I/O\n",
+                    options.Path.c_str());
+                options.Direct = false;
+            }
+#endif
+        }
+
+        if (Fd < 0) {
+            Fd = open(options.Path.c_str(), flags);
+        }
+
+        if (Fd < 0) {
+            throw std::runtime_error("Failed to open " + options.Path + ": " + strerror(errno));
+        }
+
+#ifdef F_NOCACHE
+        if (options.Direct && fcntl(Fd, F_NOCACHE, 1) != 0) {
+            fprintf(stderr, "Failed to disable page cache, falling back to buffered I/O\n");
+            options.Direct = false;
+        }
+#elif !defined(O_DIRECT)
+        options.Direct = false;
+#endif
+
+        uint64_t size = GetSize();
+        if (size == 0 && options.Size == 0) {
+            throw std::runtime_error("Failed to get the device size, specify --size");
+        }
+        if (options.Size == 0 || (size != 0 && options.Size > size)) {
+            options.Size = size;
+        }
+
+        BlockCount = options.Size / options.BlockSize;
+        if (BlockCount == 0) {
+            throw std::runtime_error("The file is smaller than the block size");
+        }
+    }
+
+    ~Device() {
+        if (Fd >= 0) {
+            close(Fd);
+        }
+    }
+
+    int GetFd() const {
+        return Fd;
+    }
+
+    uint64_t GetBlockCount() const {
+        return BlockCount;
+    }
+
+private:
+    // new file is filled with data, otherwise reads don't touch the device
+    static void Create(const std::string& path, uint64_t size) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to create " + path + ": " + strerror(errno));
+        }
+
+        std::vector<char> buffer(1 << 20, 'x');
+        for (uint64_t written = 0; written < size; ) {
+            size_t toWrite = std::min<uint64_t>(buffer.size(), size - written);
+            auto result = write(fd, buffer.data(), toWrite);
+            if (result <= 0) {
+                close(fd);
+                throw std::runtime_error("Failed to fill " + path + ": " + strerror(errno));
+            }
+            written += result;
+        }
+
+        fsync(fd);
+        close(fd);
+    }
+
+    // 0 when unknown
+    uint64_t GetSize() const {
+        struct stat st;
+        if (fstat(Fd, &st) != 0) {
+            throw std::runtime_error(std::string("Failed to stat: ") + strerror(errno));
+        }
+
+        if (S_ISBLK(st.st_mode)) {
+#ifdef BLKGETSIZE64
+            uint64_t size = 0;
+            if (ioctl(Fd, BLKGETSIZE64, &size) == 0) {
+                return size;
+            }
+#endif
+            return 0;
+        }
+
+        return st.st_size;
+    }
+
+private:
+    int Fd = -1;
+    uint64_t BlockCount = 0;
+};
+
+// ----------------------------
+// helpers
+
+struct AlignedBuffer {
+    AlignedBuffer(size_t size) {
+        if (posix_memalign(&Data, Alignment, size) != 0) {
+            throw std::bad_alloc();
+        }
+        memset(Data, 'x', size);
+    }
+
+    ~AlignedBuffer() {
+        free(Data);
+    }
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    void* Data = nullptr;
+};
+
+uint64_t ToNs(Clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+// ----------------------------
+// sync engine: each thread keeps one request in flight
+
+std::vector<uint64_t> RunSync(const Options& options, const Device& device) {
+    std::vector<std::vector<uint64_t>> threadLatencies(options.QueueDepth);
+    std::atomic<bool> failed{false};
+
+    auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.Seconds));
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.QueueDepth; ++i) {
+        threads.emplace_back([&, i] {
+            AlignedBuffer buffer(options.BlockSize);
+            std::mt19937_64 gen(std::random_device{}() + i);
+            std::uniform_int_distribution<uint64_t> dis(0, device.GetBlockCount() - 1);
+            auto& latencies = threadLatencies[i];
+
+            while (!failed && Clock::now() < deadline) {
+                off_t offset = dis(gen) * options.BlockSize;
+
+                auto start = Clock::now();
+                auto result = options.Write
+                    ? pwrite(device.GetFd(), buffer.Data, options.BlockSize, offset)
+                    : pread(device.GetFd(), buffer.Data, options.BlockSize, offset);
+                auto finish = Clock::now();
+
+                if (result != (ssize_t)options.BlockSize) {
+                    perror("I/O failed");
+                    failed = true;
+                    return;
+                }
+
+                latencies.push_back(ToNs(finish - start));
+            }
+        });
+    }
+
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    if (failed) {
+        throw std::runtime_error("I/O failed");
+    }
+
+    std::vector<uint64_t> latencies;
+    for (auto& threadLatency: threadLatencies) {
+        latencies.insert(latencies.end(), threadLatency.begin(), threadLatency.end());
+    }
+
+    return latencies;
+}
+
+// ----------------------------
+// aio engine: Linux native async I/O, a single thread keeps queue depth requests in flight
+
+#ifdef __linux__
+
+bool RunAio(const Options& options, const Device& device, std::vector<uint64_t>& latencies) {
+    aio_context_t context = 0;
+    if (syscall(SYS_io_setup, options.QueueDepth, &context) != 0) {
+        fprintf(stderr, "io_setup failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    std::vector<std::unique_ptr<AlignedBuffer>> buffers;
+    std::vector<iocb> iocbs(options.QueueDepth);
+    std::vector<Clock::time_point> startTimes(options.QueueDepth);
+
+    std::mt19937_64 gen(std::random_device{}());
+    std::uniform_int_distribution<uint64_t> dis(0, device.GetBlockCount() - 1);
+
+    auto submit = [&](size_t slot) {
+        auto& cb = iocbs[slot];
+        memset(&cb, 0, sizeof(cb));
+        cb.aio_fildes = device.GetFd();
+        cb.aio_lio_opcode = options.Write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD;
+        cb.aio_buf = (uint64_t)buffers[slot]->Data;
+        cb.aio_nbytes = options.BlockSize;
+        cb.aio_offset = dis(gen) * options.BlockSize;
+        cb.aio_data = slot;
+
+        iocb* cbs[1] = {&cb};
+        startTimes[slot] = Clock::now();
+        return syscall(SYS_io_submit, context, 1, cbs) == 1;
+    };
+
+    bool ok = true;
+    size_t inflight = 0;
+    for (size_t slot = 0; slot < options.QueueDepth; ++slot) {
+        buffers.emplace_back(std::make_unique<AlignedBuffer>(options.BlockSize));
+        if (!submit(slot)) {
+            fprintf(stderr, "io_submit failed: %s\n", strerror(errno));
+            ok = false;
+            break;
+        }
+        ++inflight;
+    }
+
+    auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.Seconds));
+
+    std::vector<io_event> events(options.QueueDepth);
+    while (inflight > 0) {
+        auto count = syscall(SYS_io_getevents, context, 1, events.size(), events.data(), nullptr);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "io_getevents failed: %s\n", strerror(errno));
+            ok = false;
+            break;
+        }
+
+        auto now = Clock::now();
+        for (long i = 0; i < count; ++i) {
+            size_t slot = events[i].data;
+            --inflight;
+
+            if (events[i].res != (int64_t)options.BlockSize) {
+                fprintf(stderr, "I/O failed: %s\n", strerror(-events[i].res));
+                ok = false;
+                continue;
+            }
+
+            latencies.push_back(ToNs(now - startTimes[slot]));
+
+            if (ok && now < deadline) {
+                if (!submit(slot)) {
+                    fprintf(stderr, "io_submit failed: %s\n", strerror(errno));
+                    ok = false;
+                    continue;
+                }
+                ++inflight;
+            }
+        }
+    }
+
+    syscall(SYS_io_destroy, context);
+
+    if (!ok && latencies.empty()) {
+        return false;
+    }
+
+    if (!ok) {
+        throw std::runtime_error("I/O failed");
+    }
+
+    return true;
+}
+
+#endif
+
+// ----------------------------
+// output
+
+uint64_t GetPercentile(const std::vector<uint64_t>& sortedLatencies, double percentile) {
+    size_t rank = (size_t)std::ceil(percentile / 100 * sortedLatencies.size());
+    rank = std::max<size_t>(rank, 1);
+    return sortedLatencies[std::min(rank, sortedLatencies.size()) - 1];
+}
+
+// elapsed is the measured wall time of the run, including the drain of the last in-flight requests
+void PrintPercentiles(const Options& options, const std::string& engine, std::vector<uint64_t>& latencies, double elapsedSeconds) {
+    if (latencies.empty()) {
+        throw std::runtime_error("No I/O finished");
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("// %s: %zu bytes %s, queue depth %zu, %s engine, %s I/O\n",
+        options.Path.c_str(), options.BlockSize, options.Write ? "writes" : "reads",
+        options.QueueDepth, engine.c_str(), options.Direct ? "direct" : "buffered");
+    printf("// %zu requests in %.1f s, %.0f IOPS\n",
+        latencies.size(), elapsedSeconds, latencies.size() / elapsedSeconds);
+
+    printf("PercentileTimeProcessor::Percentiles %s = {\n", options.Name.c_str());
+
+    // rows with the same value are merged: only the highest percentile is kept
+    for (size_t i = 0; i < OutputPercentiles.size(); ++i) {
+        auto valueUs = (GetPercentile(latencies, OutputPercentiles[i]) + 999) / 1000;
+        if (i + 1 < OutputPercentiles.size()) {
+            auto nextValueUs = (GetPercentile(latencies, OutputPercentiles[i + 1]) + 999) / 1000;
+            if (nextValueUs == valueUs) {
+                continue;
+            }
+        }
+
+        printf("    {%g, %lu * Usec},\n", OutputPercentiles[i], (unsigned long)valueUs);
+    }
+
+    printf("};\n");
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    try {
+        auto options = ParseOptions(argc, argv);
+        Device device(options);
+
+        std::vector<uint64_t> latencies;
+        std::string engine = options.Engine;
+        auto start = Clock::now();
+
+        if (engine == "aio") {
+#ifdef __linux__
+            // buffered aio is synchronous in Linux, so it would not keep the queue depth
+            if (!options.Direct || !RunAio(options, device, latencies)) {
+                fprintf(stderr, "Async I/O is not available, falling back to sync engine\n");
+                engine = "sync";
+            }
+#else
+            fprintf(stderr, "Async I/O is not supported on this platform, falling back to sync engine\n");
+            engine = "sync";
+#endif
+        }
+
+        if (engine == "sync") {
+            start = Clock::now();
+            latencies = RunSync(options, device);
+        }
+
+        auto elapsedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+        PrintPercentiles(options, engine, latencies, elapsedSeconds);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
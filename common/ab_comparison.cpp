@@ -0,0 +1,333 @@
+#include "ab_comparison.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <numeric>
+#include <exception>
+#include <mutex>
+
+namespace queue_sim {
+
+// ----------------------------
+// Student's t-distribution
+
+// continued fraction of the regularized incomplete beta function (modified Lentz's method)
+static double IncompleteBetaFraction(double a, double b, double x) {
+    constexpr int maxIterations = 300;
+    constexpr double epsilon = 1e-14;
+    constexpr double tiny = 1e-300;
+
+    double c = 1;
+    double d = 1 - (a + b) * x / (a + 1);
+    if (std::abs(d) < tiny) {
+        d = tiny;
+    }
+    d = 1 / d;
+    double result = d;
+
+    for (int m = 1; m <= maxIterations; ++m) {
+        // even step
+        double numerator = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        d = 1 + numerator * d;
+        d = std::abs(d) < tiny ? 1 / tiny : 1 / d;
+        c = 1 + numerator / c;
+        if (std::abs(c) < tiny) {
+            c = tiny;
+        }
+        result *= d * c;
+
+        // odd step
+        numerator = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+        d = 1 + numerator * d;
+        d = std::abs(d) < tiny ? 1 / tiny : 1 / d;
+        c = 1 + numerator / c;
+        if (std::abs(c) < tiny) {
+            c = tiny;
+        }
+        double step = d * c;
+        result *= step;
+
+        if (std::abs(step - 1) < epsilon) {
+            break;
+        }
+    }
+
+    return result;
+}
+
+static double RegularizedIncompleteBeta(double a, double b, double x) {
+    if (x <= 0) {
+        return 0;
+    }
+    if (x >= 1) {
+        return 1;
+    }
+
+    double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b)
+        + a * std::log(x) + b * std::log(1 - x));
+
+    // the fraction converges fast only on this side
+    if (x < (a + 1) / (a + b + 2)) {
+        return front * IncompleteBetaFraction(a, b, x) / a;
+    }
+    return 1 - front * IncompleteBetaFraction(b, a, 1 - x) / b;
+}
+
+double StudentTCdf(double t, double degreesOfFreedom) {
+    double tail = 0.5 * RegularizedIncompleteBeta(degreesOfFreedom / 2, 0.5, degreesOfFreedom / (degreesOfFreedom + t * t));
+    return t >= 0 ? 1 - tail : tail;
+}
+
+double StudentTCritical(double confidence, double degreesOfFreedom) {
+    if (confidence <= 0 || confidence >= 1) {
+        throw std::runtime_error("Confidence must be between 0 and 1");
+    }
+
+    // CDF is monotonic, bisection is precise enough
+    double target = 0.5 + confidence / 2;
+    double low = 0;
+    double high = 1;
+    while (StudentTCdf(high, degreesOfFreedom) < target) {
+        high *= 2;
+    }
+    for (int i = 0; i < 100; ++i) {
+        double middle = (low + high) / 2;
+        if (StudentTCdf(middle, degreesOfFreedom) < target) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return high;
+}
+
+// ----------------------------
+// metrics
+
+struct Metric {
+    const char* Name;
+    bool HigherIsBetter;
+    bool IsPercentile; // histogram bucket bounds
+    std::function<double(const PipeLineResults&)> Get;
+};
+
+static const std::vector<Metric>& GetMetrics() {
+    static const std::vector<Metric> metrics = {
+        {"RPS", true, false, [](const PipeLineResults& results) { return results.ThroughputRps; }},
+        {"mean us", false, false, [](const PipeLineResults& results) { return results.IntendedStartLatencyUs.MeanUs.value_or(0); }},
+        {"p50 us", false, true, [](const PipeLineResults& results) { return (double)results.IntendedStartLatencyUs.P50Us; }},
+        {"p90 us", false, true, [](const PipeLineResults& results) { return (double)results.IntendedStartLatencyUs.P90Us; }},
+        {"p99 us", false, true, [](const PipeLineResults& results) { return (double)results.IntendedStartLatencyUs.P99Us; }},
+        {"p99.9 us", false, true, [](const PipeLineResults& results) { return (double)results.IntendedStartLatencyUs.P999Us; }},
+    };
+    return metrics;
+}
+
+// paired t-test: replication i of the variant is compared to replication i of the baseline.
+// Significance is decided later, by AdjustPValues
+static MetricComparison CompareMetric(
+    const Metric& metric,
+    const std::vector<PipeLineResults>& baseline,
+    const std::vector<PipeLineResults>& variant,
+    const ComparisonConfig& config)
+{
+    MetricComparison comparison;
+    comparison.Name = metric.Name;
+    comparison.HigherIsBetter = metric.HigherIsBetter;
+
+    size_t n = baseline.size();
+    std::vector<double> deltas(n);
+    for (size_t i = 0; i < n; ++i) {
+        double baselineValue = metric.Get(baseline[i]);
+        double variantValue = metric.Get(variant[i]);
+        comparison.BaselineMean += baselineValue / n;
+        comparison.VariantMean += variantValue / n;
+        deltas[i] = variantValue - baselineValue;
+    }
+
+    for (auto delta: deltas) {
+        comparison.Delta += delta / n;
+    }
+
+    double variance = 0;
+    for (auto delta: deltas) {
+        variance += (delta - comparison.Delta) * (delta - comparison.Delta) / (n - 1);
+    }
+    double stdError = std::sqrt(variance / n);
+
+    double degreesOfFreedom = n - 1;
+    double halfWidth = StudentTCritical(config.Confidence, degreesOfFreedom) * stdError;
+    comparison.DeltaLow = comparison.Delta - halfWidth;
+    comparison.DeltaHigh = comparison.Delta + halfWidth;
+
+    if (stdError > 0) {
+        double t = comparison.Delta / stdError;
+        comparison.PValue = 2 * StudentTCdf(-std::abs(t), degreesOfFreedom);
+    } else if (comparison.Delta == 0) {
+        comparison.PValue = 1;
+    } else if (metric.IsPercentile) {
+        // all the replications have the same delta, i.e. the same pair of buckets
+        comparison.Discrete = true;
+        comparison.PValue = 1;
+    } else {
+        // the same delta of a continuous metric in all the replications
+        comparison.PValue = 0;
+    }
+
+    return comparison;
+}
+
+// Holm-Bonferroni: the i-th smallest of m p-values is multiplied by m - i,
+// adjusted p-values are kept monotonic
+static void AdjustPValues(std::vector<MetricComparison>& metrics) {
+    std::vector<size_t> order(metrics.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&metrics](size_t lhs, size_t rhs) {
+        return metrics[lhs].PValue < metrics[rhs].PValue;
+    });
+
+    double maxAdjusted = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        auto& metric = metrics[order[i]];
+        maxAdjusted = std::max(maxAdjusted, std::min(1.0, (order.size() - i) * metric.PValue));
+        metric.AdjustedPValue = maxAdjusted;
+    }
+}
+
+static void FlagRegressions(std::vector<MetricComparison>& metrics, const ComparisonConfig& config) {
+    for (auto& metric: metrics) {
+        metric.Significant = metric.AdjustedPValue < 1 - config.Confidence;
+
+        double worseShare = (metric.HigherIsBetter ? -1 : 1) * metric.GetRelativeDelta();
+        metric.Regression = metric.Significant && worseShare > config.RegressionThreshold;
+    }
+}
+
+// ----------------------------
+// CompareVariants
+
+static PipeLineResults RunReplication(
+    const ModelVariant& variant,
+    const ComparisonConfig& config,
+    size_t replication,
+    arctic::Sprite sprite)
+{
+    SetSimulationSeed(config.BaseSeed + replication);
+
+    ClosedPipeLine pipeline(sprite);
+    variant.Setup(pipeline);
+
+    while (Now() < config.SimulatedTime) {
+        AdvanceTime(config.TickInterval);
+        pipeline.Tick(config.TickInterval);
+    }
+
+    return pipeline.GetResults();
+}
+
+ComparisonReport CompareVariants(
+    const std::vector<ModelVariant>& variants,
+    const ComparisonConfig& config,
+    arctic::Sprite sprite)
+{
+    if (variants.size() < 2) {
+        throw std::runtime_error("Comparison needs a baseline and at least one variant");
+    }
+    if (config.Replications < 2) {
+        throw std::runtime_error("Comparison needs at least 2 replications");
+    }
+
+    ComparisonReport report;
+    report.Config = config;
+    for (const auto& variant: variants) {
+        VariantComparison comparison;
+        comparison.Name = variant.Name;
+        comparison.Runs.resize(config.Replications);
+        report.Variants.push_back(std::move(comparison));
+    }
+
+    size_t runCount = variants.size() * config.Replications;
+    std::atomic<size_t> nextRun = 0;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto worker = [&] {
+        for (size_t run = nextRun++; run < runCount; run = nextRun++) {
+            size_t variant = run % variants.size();
+            size_t replication = run / variants.size();
+
+            // clock, event counter and seeds are per thread, so each run starts from scratch
+            std::thread([&] {
+                try {
+                    report.Variants[variant].Runs[replication] =
+                        RunReplication(variants[variant], config, replication, sprite);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(errorMutex);
+                    error = std::current_exception();
+                }
+            }).join();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::max<size_t>(config.Parallelism, 1); ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto& thread: workers) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    const auto& baselineRuns = report.Variants.front().Runs;
+    for (size_t i = 1; i < report.Variants.size(); ++i) {
+        auto& variant = report.Variants[i];
+        for (const auto& metric: GetMetrics()) {
+            variant.Metrics.push_back(CompareMetric(metric, baselineRuns, variant.Runs, config));
+        }
+        AdjustPValues(variant.Metrics);
+        FlagRegressions(variant.Metrics, config);
+    }
+
+    return report;
+}
+
+// ----------------------------
+// ComparisonReport
+
+std::string ComparisonReport::GetText() const {
+    std::string result;
+    char text[512];
+
+    const auto& baseline = Variants.front();
+    for (size_t i = 1; i < Variants.size(); ++i) {
+        const auto& variant = Variants[i];
+        snprintf(text, sizeof(text), "%s vs %s: %ld replications, %.0f%% confidence intervals, Holm-adjusted p\n",
+            variant.Name.c_str(), baseline.Name.c_str(), Config.Replications, 100 * Config.Confidence);
+        result += text;
+
+        for (const auto& metric: variant.Metrics) {
+            const char* verdict = "";
+            if (metric.Regression) {
+                verdict = "  REGRESSION";
+            } else if (metric.Significant) {
+                verdict = "  significant";
+            } else if (metric.Discrete) {
+                verdict = "  discrete";
+            }
+
+            snprintf(text, sizeof(text),
+                "  %-9s %10.1f -> %10.1f, delta: %+.1f [%+.1f, %+.1f] (%+.2f%%), p: %.4f (raw %.4f)%s\n",
+                metric.Name.c_str(), metric.BaselineMean, metric.VariantMean,
+                metric.Delta, metric.DeltaLow, metric.DeltaHigh, 100 * metric.GetRelativeDelta(),
+                metric.AdjustedPValue, metric.PValue, verdict);
+            result += text;
+        }
+    }
+
+    return result;
+}
+
+} // namespace queue_sim
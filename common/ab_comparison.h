@@ -0,0 +1,146 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+#include "engine/easy_sprite.h"
+
+#include "common.h"
+#include "results.h"
+#include "simple_pipeline.h"
+
+// A/B comparison of model variants. Each replication runs all variants with the same
+// simulation seed (common random numbers), so the variants see the same random samples
+// as far as they create generators in the same order. The variants are compared to
+// the first one by the paired t-test over replications. A variant is compared by several
+// metrics at once, so its p-values are adjusted by the Holm-Bonferroni method.
+
+namespace queue_sim {
+
+// ----------------------------
+// ModelVariant
+
+struct ModelVariant {
+    std::string Name;
+    std::function<void(ClosedPipeLine&)> Setup;
+};
+
+// ----------------------------
+// ComparisonConfig
+
+struct ComparisonConfig {
+    size_t Replications = 8;
+    SimTime SimulatedTime = 1 * Sec;
+    SimTime TickInterval = 1 * Usec;
+
+    // replication i uses the seed BaseSeed + i
+    uint64_t BaseSeed = 1;
+
+    // runs at the same time, each run has its own thread (clock and event counter are per thread)
+    size_t Parallelism = std::max(1u, std::thread::hardware_concurrency());
+
+    // of the confidence intervals, 1 - Confidence is the significance level of each variant,
+    // i.e. of all its metrics together
+    double Confidence = 0.95;
+
+    // the variant has regressed, when a metric is significantly worse by more than
+    // the share of the baseline value
+    double RegressionThreshold = 0.05;
+};
+
+// ----------------------------
+// MetricComparison
+
+struct MetricComparison {
+    std::string Name;
+    bool HigherIsBetter = false;
+
+    double BaselineMean = 0;
+    double VariantMean = 0;
+
+    // variant minus baseline: mean and confidence interval (not adjusted for the metric count)
+    double Delta = 0;
+    double DeltaLow = 0;
+    double DeltaHigh = 0;
+
+    // two-sided, of the paired t-test
+    double PValue = 1;
+
+    // adjusted for the number of the variant's metrics, significance is decided by it
+    double AdjustedPValue = 1;
+
+    // a percentile has the same delta in all the replications, e.g. it has moved to
+    // the next histogram bucket. The t-test can't tell anything then, the delta is
+    // reported, but it is neither significant nor a regression
+    bool Discrete = false;
+
+    bool Significant = false;
+    bool Regression = false;
+
+    double GetRelativeDelta() const {
+        return BaselineMean != 0 ? Delta / BaselineMean : 0;
+    }
+};
+
+// ----------------------------
+// VariantComparison
+
+struct VariantComparison {
+    std::string Name;
+    std::vector<MetricComparison> Metrics;
+
+    // the results of each replication
+    std::vector<PipeLineResults> Runs;
+
+    bool HasRegression() const {
+        for (const auto& metric: Metrics) {
+            if (metric.Regression) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// ----------------------------
+// ComparisonReport
+
+struct ComparisonReport {
+    ComparisonConfig Config;
+
+    // the first one is the baseline, its metrics are empty
+    std::vector<VariantComparison> Variants;
+
+    bool HasRegression() const {
+        for (const auto& variant: Variants) {
+            if (variant.HasRegression()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string GetText() const;
+};
+
+// the first variant is the baseline. Latencies are from the intended start, i.e. the same
+// as from the actual start, unless the variant sets the intended rate. Percentiles are
+// the histogram bucket bounds, thus small deltas might be not visible at all, and a shift
+// by the same buckets in all the replications is only reported, see MetricComparison::Discrete
+ComparisonReport CompareVariants(
+    const std::vector<ModelVariant>& variants,
+    const ComparisonConfig& config,
+    arctic::Sprite sprite);
+
+// ----------------------------
+// Student's t-distribution, used by the comparison
+
+double StudentTCdf(double t, double degreesOfFreedom);
+
+// the value t, such that P(|T| <= t) = confidence
+double StudentTCritical(double confidence, double degreesOfFreedom);
+
+} // namespace queue_sim
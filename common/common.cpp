@@ -2,17 +2,44 @@
 
 namespace queue_sim {
 
-static double CurrentTimeSeconds = 0;
+// each thread has own time, see ParallelSimulation
+static thread_local SimTime CurrentTime = 0;
 
 // ----------------------------
 // our global time
 
-double Now() {
-    return CurrentTimeSeconds;
+SimTime Now() {
+    return CurrentTime;
 }
 
-void AdvanceTime(double dt) {
-    CurrentTimeSeconds += dt;
+void AdvanceTime(SimTime dt) {
+    CurrentTime += dt;
+}
+
+void SetTime(SimTime now) {
+    CurrentTime = now;
+}
+
+// ----------------------------
+// random seeds
+
+// empty, when generators are seeded by the random device
+static thread_local std::unique_ptr<std::mt19937_64> SeedGen;
+
+void SetSimulationSeed(uint64_t seed) {
+    std::seed_seq seq{(uint32_t)seed, (uint32_t)(seed >> 32)};
+    SeedGen = std::make_unique<std::mt19937_64>(seq);
+}
+
+void ResetSimulationSeed() {
+    SeedGen.reset();
+}
+
+uint32_t NewRandomSeed() {
+    if (!SeedGen) {
+        return std::random_device{}();
+    }
+    return (uint32_t)(*SeedGen)();
 }
 
 // ----------------------------
@@ -41,6 +68,22 @@ std::string NumToStrWithSuffix(size_t num) {
     }
 }
 
+std::string FormatLatencyStats(SimTime timePassed, size_t finishedEvents, size_t avgRPS, Histogram& durationsUs) {
+    char text[512];
+    snprintf(text, sizeof(text),
+        "TimePassed: %.2f s, Events: %ld, AvgRPS: %ld\np10: %d us, p50: %d us, p90: %d us, p99: %d us, p100: %d us",
+        ToSeconds(timePassed),
+        finishedEvents,
+        avgRPS,
+        durationsUs.GetPercentile(10),
+        durationsUs.GetPercentile(50),
+        durationsUs.GetPercentile(90),
+        durationsUs.GetPercentile(99),
+        durationsUs.GetPercentile(100)
+    );
+    return text;
+}
+
 // ----------------------------
 // Histogram
 //
@@ -71,12 +114,12 @@ Event Event::NewEvent(size_t src, size_t dst) {
     return Event(src, dst);
 }
 
-size_t Event::EventCounter = 0;
+thread_local size_t Event::EventCounter = 0;
 
 // ----------------------------
 // ItemBase
 //
 
-size_t ItemBase::ItemCounter = 0;
+std::atomic<size_t> ItemBase::ItemCounter{0};
 
 } // namespace queue_sim
@@ -1,18 +1,45 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "engine/easy.h"
 #include "engine/easy_drawing.h"
 #include "engine/easy_sprite.h"
 
+#include "snapshot.h"
+
 namespace queue_sim {
 
-constexpr double Usec = 0.000001;
-constexpr double Msec = 0.001;
+// simulation time is an integer number of nanoseconds: it is exact and
+// cheap to compare, long runs are reproducible
+using SimTime = int64_t;
+
+constexpr SimTime Nsec = 1;
+constexpr SimTime Usec = 1000 * Nsec;
+constexpr SimTime Msec = 1000 * Usec;
+constexpr SimTime Sec = 1000 * Msec;
+
+constexpr double ToSeconds(SimTime time) {
+    return (double)time / Sec;
+}
 
-constexpr double LoadAvgIntervalUsec = 1000'000;
+// for configs and random samples only, not for the hot path
+inline SimTime FromSeconds(double seconds) {
+    return (SimTime)std::llround(seconds * Sec);
+}
+
+constexpr SimTime LoadAvgInterval = 1 * Sec;
 
 const arctic::Rgba BackgroundColor(255, 255, 255);
 const arctic::Rgba YDBColorDarkViolet(116, 105, 162);
@@ -20,10 +47,21 @@ const arctic::Rgba YDBColorWorker(37, 153, 255);
 const arctic::Rgba YDBColorQueue(124, 142, 224);
 
 // ----------------------------
-// our global time
+// our global time, it's per thread
 
-double Now();
-void AdvanceTime(double dt);
+SimTime Now();
+void AdvanceTime(SimTime dt);
+void SetTime(SimTime now); // used to restore snapshots
+
+// ----------------------------
+// random seeds, per thread as the time. By default generators are seeded by the
+// random device. When the simulation seed is set, the n-th generator created in the
+// thread gets the n-th seed of the sequence: models built in the same order get
+// the same random numbers (common random numbers for A/B comparisons)
+
+void SetSimulationSeed(uint64_t seed);
+void ResetSimulationSeed();
+uint32_t NewRandomSeed();
 
 // ----------------------------
 // helpers
@@ -32,6 +70,11 @@ arctic::Font& GetFont();
 
 std::string NumToStrWithSuffix(size_t num);
 
+class Histogram;
+
+// the same summary is used by the simulation and by the real threads
+std::string FormatLatencyStats(SimTime timePassed, size_t finishedEvents, size_t avgRPS, Histogram& durationsUs);
+
 // ----------------------------
 // Histogram
 
@@ -55,16 +98,63 @@ public:
     static Histogram HistogramWithUsBuckets();
 
     void AddDuration(int duration) {
-        for (size_t i = 0; i < Buckets.size(); ++i) {
-            if (duration < Buckets[i]) {
-                ++Counts[i];
-                return;
+        // the first bucket with duration < threshold, the last one is for the rest
+        auto it = std::upper_bound(Buckets.begin(), Buckets.end(), duration);
+        ++Counts[it - Buckets.begin()];
+    }
+
+    // for histograms with us buckets
+    void AddTime(SimTime duration) {
+        AddDuration((int)(duration / Usec));
+    }
+
+    void Merge(const Histogram& other) {
+        if (other.Buckets != Buckets) {
+            throw std::runtime_error("Can't merge histograms with different buckets.");
+        }
+
+        for (size_t i = 0; i < Counts.size(); ++i) {
+            Counts[i] += other.Counts[i];
+        }
+    }
+
+    void Save(SnapshotWriter& writer) const {
+        writer.Write(Counts.size());
+        for (int count: Counts) {
+            writer.Write(count);
+        }
+    }
+
+    void Load(SnapshotReader& reader) {
+        if (reader.Read<size_t>() != Counts.size()) {
+            throw std::runtime_error("Histogram in snapshot has different buckets.");
+        }
+        for (int& count: Counts) {
+            reader.Read(count);
+        }
+    }
+
+    // number of durations not less than the value, which is a bucket threshold
+    int GetCountFrom(int value) const {
+        int count = 0;
+        for (size_t i = 1; i < Counts.size(); ++i) {
+            if (Buckets[i - 1] >= value) {
+                count += Counts[i];
             }
         }
-        ++Counts.back();
+        return count;
+    }
+
+    int GetCount() const {
+        int count = 0;
+        for (int bucketCount: Counts) {
+            count += bucketCount;
+        }
+        return count;
     }
 
-    int GetPercentile(int percentile) {
+    // the upper bound of the bucket with the percentile
+    int GetPercentile(double percentile) const {
         if (percentile < 0 || percentile > 100) {
             throw std::runtime_error("Percentile must be between 0 and 100.");
         }
@@ -80,7 +170,8 @@ public:
         for (size_t i = 0; i < Counts.size(); ++i) {
             cumulativeCount += Counts[i];
             if (cumulativeCount >= threshold) {
-                return Buckets[i];
+                // the last bucket has no upper bound
+                return i < Buckets.size() ? Buckets[i] : Buckets.back();
             }
         }
 
@@ -116,11 +207,11 @@ public:
         return Id < other.Id;
     }
 
-    double GetDuration() const {
+    SimTime GetDuration() const {
         return Now() - StartTime;
     }
 
-    double GetStageDuration() const {
+    SimTime GetStageDuration() const {
         return Now() - StageStarted;
     }
 
@@ -140,6 +231,56 @@ public:
         return DstId;
     }
 
+    SimTime GetStartTime() const {
+        return StartTime;
+    }
+
+    SimTime GetStageStartTime() const {
+        return StageStarted;
+    }
+
+    void Save(SnapshotWriter& writer) const {
+        writer.Write(Id);
+        writer.Write(SrcId);
+        writer.Write(DstId);
+        writer.Write(StartTime);
+        writer.Write(StageStarted);
+    }
+
+    static Event Load(SnapshotReader& reader) {
+        Event event(reader);
+        return event;
+    }
+
+    static size_t GetEventCounter() {
+        return EventCounter;
+    }
+
+    static void SetEventCounter(size_t counter) {
+        EventCounter = counter;
+    }
+
+private:
+    friend class EventStorage;
+
+    // restores the event without changing the counter
+    Event(size_t id, SimTime startTime, SimTime stageStarted)
+        : Id(id)
+        , StartTime(startTime)
+        , StageStarted(stageStarted)
+    {
+    }
+
+    // restores the event without changing the counter
+    explicit Event(SnapshotReader& reader)
+        : Id(reader.Read<size_t>())
+        , SrcId(reader.Read<size_t>())
+        , DstId(reader.Read<size_t>())
+        , StartTime(reader.Read<SimTime>())
+        , StageStarted(reader.Read<SimTime>())
+    {
+    }
+
 private:
     size_t Id;
 
@@ -147,10 +288,43 @@ private:
     size_t SrcId = 0;
     size_t DstId = 0;
 
-    double StartTime = 0;
-    double StageStarted = 0;
+    SimTime StartTime = 0;
+    SimTime StageStarted = 0;
+
+    static thread_local size_t EventCounter;
+};
+
+// ----------------------------
+// StageFault: current degradation of a stage, set by FaultInjector.
+// Stages honor the parts which make sense for them
+
+struct StageFault {
+    // service takes this times longer (executors and devices)
+    double ServiceTimeMultiplier = 1;
+
+    // nothing progresses and nothing leaves the stage
+    bool Stalled = false;
+
+    // number of executor's processors, which neither progress nor take new events
+    size_t LostProcessors = 0;
 
-    static size_t EventCounter;
+    // events are accepted, but nothing leaves the stage
+    bool Frozen = false;
+
+    bool BlocksPop() const {
+        return Stalled || Frozen;
+    }
+
+    // the part of dt lost by work in progress
+    SimTime GetLostTime(SimTime dt) const {
+        if (Stalled) {
+            return dt;
+        }
+        if (ServiceTimeMultiplier != 1) {
+            return dt - (SimTime)(dt / ServiceTimeMultiplier);
+        }
+        return 0;
+    }
 };
 
 // ----------------------------
@@ -170,7 +344,9 @@ public:
 
     virtual ~ItemBase() = default;
 
-    virtual void Tick(double dt) = 0;
+    virtual const char* GetName() const = 0;
+
+    virtual void Tick(SimTime dt) = 0;
 
     virtual bool IsReadyToPushEvent() const = 0;
     virtual void PushEvent(Event event) = 0;
@@ -178,21 +354,358 @@ public:
     virtual bool IsReadyToPopEvent() const = 0;
     virtual Event PopEvent() = 0;
 
+    // number of events, which have been pushed and haven't been popped yet
+    virtual size_t GetEventCount() const = 0;
+
+    // time spent in service, i.e. in the stage without waiting for a processor or for
+    // the next stage. Null, when not applicable
+    virtual const Histogram* GetServiceTimeUs() const {
+        return nullptr;
+    }
+
+    // time events have been held back by admission control, events admitted at once
+    // are not counted. Null, when not applicable
+    virtual const Histogram* GetThrottlingDelayUs() const {
+        return nullptr;
+    }
+
+    // called by the chain: the stage, which takes events from this one
+    virtual void SetNextStage(const ItemBase* /* stage */) {
+    }
+
+    // removes the event from the stage and frees its slot, e.g. when the event has timed out.
+    // Returns true, when the event won't leave the stage. Stages, which can't cancel, ignore it
+    virtual bool CancelEvent(size_t /* id */) {
+        return false;
+    }
+
+    // state only, the config is set by the constructor.
+    // Note, that the fault isn't a part of the state: it is applied by FaultInjector
+    virtual void SaveState(SnapshotWriter& writer) const = 0;
+    virtual void LoadState(SnapshotReader& reader) = 0;
+
 public:
     virtual void Draw(arctic::Sprite toSprite) = 0;
 
+public:
+    void SetFault(const StageFault& fault) {
+        Fault = fault;
+    }
+
+    const StageFault& GetFault() const {
+        return Fault;
+    }
+
+protected:
+    StageFault Fault;
+
 private:
     size_t ItemId;
 
-    static size_t ItemCounter;
+    static std::atomic<size_t> ItemCounter;
 };
 
 using ItemPtr = std::unique_ptr<ItemBase>;
 
+// ----------------------------
+// EventStorage: compact FIFO of events for long queues.
+// Events are stored in chunks, an event takes 12 bytes instead of sizeof(Event):
+// the stage start time is a 32 bit delta from the chunk base, the id is a 16 bit signed
+// delta from the id of the previous event in the chunk (a new chunk is started, when
+// either doesn't fit), the start time is a 36 bit age at the stage start and src/dst
+// are a 12 bit index in the dictionary of the storage. Thus ids may have gaps and may
+// come out of order, e.g. behind an executor with many processors. Events, which can't
+// be represented this way (events older than ~68 seconds, too many src/dst pairs),
+// are stored verbatim. Chunks are freed as the queue shrinks. Removed events are
+// skipped till they reach the front, the way FlushController skips cancelled ones.
+
+class EventStorage {
+private:
+    static constexpr size_t ChunkSize = 4096;
+    static constexpr uint32_t VerbatimDelta = UINT32_MAX;
+
+    static constexpr int AgeBits = 36;
+    static constexpr int RouteBits = 12;
+    static constexpr int IdDeltaBits = 64 - AgeBits - RouteBits;
+
+    static constexpr uint64_t MaxAge = (1ull << AgeBits) - 1;
+    static constexpr uint64_t MaxRoutes = 1ull << RouteBits;
+    static constexpr int64_t MaxIdDelta = (1ll << (IdDeltaBits - 1)) - 1;
+    static constexpr int64_t MinIdDelta = -(1ll << (IdDeltaBits - 1));
+
+    using Route = std::pair<size_t, size_t>; // src and dst
+
+    struct Chunk {
+        SimTime BaseTs = 0;
+
+        // ids of the events at Begin and at End - 1
+        size_t FrontId = 0;
+        size_t BackId = 0;
+
+        // of all the events pushed to the chunk
+        size_t MinId = 0;
+        size_t MaxId = 0;
+
+        size_t Begin = 0;
+        size_t End = 0;
+
+        uint32_t StageDelta[ChunkSize];
+
+        // from the low bits: age, route index and id delta. Verbatim events have the id delta only
+        uint64_t AgeRouteAndId[ChunkSize];
+
+        std::deque<Event> VerbatimEvents;
+    };
+
+public:
+    void PushBack(const Event& event) {
+        if (Chunks.empty() || Chunks.back()->End == ChunkSize || !FitsChunk(*Chunks.back(), event)) {
+            Chunks.push_back(NewChunk());
+        }
+
+        auto& chunk = *Chunks.back();
+        if (chunk.End == 0) {
+            chunk.BaseTs = event.StageStarted;
+            chunk.FrontId = event.Id;
+            chunk.BackId = event.Id;
+            chunk.MinId = event.Id;
+            chunk.MaxId = event.Id;
+        }
+        chunk.MinId = std::min(chunk.MinId, event.Id);
+        chunk.MaxId = std::max(chunk.MaxId, event.Id);
+
+        auto index = chunk.End++;
+        uint64_t idDelta = (uint64_t)(event.Id - chunk.BackId) << (AgeBits + RouteBits);
+        chunk.BackId = event.Id;
+
+        if (!Encode(chunk, index, event)) {
+            chunk.StageDelta[index] = VerbatimDelta;
+            chunk.AgeRouteAndId[index] = 0;
+            chunk.VerbatimEvents.push_back(event);
+        }
+        chunk.AgeRouteAndId[index] |= idDelta;
+
+        ++Count;
+    }
+
+    Event Front() const {
+        if (Count == 0) {
+            throw std::runtime_error("Event storage is empty");
+        }
+
+        const auto& chunk = *Chunks.front();
+        auto index = chunk.Begin;
+        if (chunk.StageDelta[index] == VerbatimDelta) {
+            return chunk.VerbatimEvents.front();
+        }
+
+        return Decode(chunk, index, chunk.FrontId);
+    }
+
+    void PopFront() {
+        if (Count == 0) {
+            throw std::runtime_error("Event storage is empty");
+        }
+
+        PopFrontSlot();
+        --Count;
+        SkipRemoved();
+    }
+
+    template <typename TCallback>
+    void ForEach(TCallback&& callback) const {
+        for (const auto& chunk: Chunks) {
+            auto verbatimIt = chunk->VerbatimEvents.begin();
+            size_t id = chunk->FrontId;
+            for (size_t i = chunk->Begin; i < chunk->End; ++i) {
+                if (i != chunk->Begin) {
+                    id += GetIdDelta(*chunk, i);
+                }
+                if (chunk->StageDelta[i] == VerbatimDelta) {
+                    const auto& event = *verbatimIt++;
+                    if (!IsRemoved(id)) {
+                        callback(event);
+                    }
+                } else if (!IsRemoved(id)) {
+                    callback(Decode(*chunk, i, id));
+                }
+            }
+        }
+    }
+
+    size_t Size() const {
+        return Count;
+    }
+
+    bool Empty() const {
+        return Count == 0;
+    }
+
+    void Clear() {
+        Chunks.clear();
+        RemovedIds.clear();
+        Count = 0;
+    }
+
+    // only the chunks, which id range has the id, are scanned: usually one.
+    // Returns false, when the event isn't in the storage
+    bool Remove(size_t id) {
+        if (IsRemoved(id) || !Contains(id)) {
+            return false;
+        }
+
+        RemovedIds.insert(id);
+        --Count;
+        SkipRemoved();
+        return true;
+    }
+
+    // approximate, without the allocator overhead
+    size_t GetMemoryBytes() const {
+        size_t bytes = Routes.size() * (2 * sizeof(Route) + sizeof(uint64_t)) + RemovedIds.size() * sizeof(size_t);
+        for (const auto& chunk: Chunks) {
+            bytes += sizeof(Chunk) + chunk->VerbatimEvents.size() * sizeof(Event);
+        }
+        return bytes;
+    }
+
+private:
+    void PopFrontSlot() {
+        auto& chunk = *Chunks.front();
+        if (chunk.StageDelta[chunk.Begin] == VerbatimDelta) {
+            chunk.VerbatimEvents.pop_front();
+        }
+
+        ++chunk.Begin;
+
+        if (chunk.Begin == chunk.End) {
+            if (Chunks.size() == 1) {
+                ResetChunk(chunk);
+            } else {
+                // keep one chunk to not allocate, when the queue size oscillates around the chunk boundary
+                SpareChunk = std::move(Chunks.front());
+                Chunks.pop_front();
+            }
+        } else {
+            chunk.FrontId += GetIdDelta(chunk, chunk.Begin);
+        }
+    }
+
+    // the front event is never a removed one
+    void SkipRemoved() {
+        while (!RemovedIds.empty() && !Chunks.empty() && Chunks.front()->Begin != Chunks.front()->End) {
+            auto it = RemovedIds.find(Chunks.front()->FrontId);
+            if (it == RemovedIds.end()) {
+                break;
+            }
+            RemovedIds.erase(it);
+            PopFrontSlot();
+        }
+    }
+
+    bool IsRemoved(size_t id) const {
+        return !RemovedIds.empty() && RemovedIds.count(id);
+    }
+
+    bool Contains(size_t id) const {
+        for (const auto& chunk: Chunks) {
+            if (chunk->Begin == chunk->End || id < chunk->MinId || id > chunk->MaxId) {
+                continue;
+            }
+            size_t currentId = chunk->FrontId;
+            for (size_t i = chunk->Begin; i < chunk->End; ++i) {
+                if (i != chunk->Begin) {
+                    currentId += GetIdDelta(*chunk, i);
+                }
+                if (currentId == id) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    std::unique_ptr<Chunk> NewChunk() {
+        if (SpareChunk) {
+            auto chunk = std::move(SpareChunk);
+            ResetChunk(*chunk);
+            return chunk;
+        }
+        return std::make_unique<Chunk>();
+    }
+
+    static void ResetChunk(Chunk& chunk) {
+        chunk.Begin = 0;
+        chunk.End = 0;
+        chunk.VerbatimEvents.clear();
+    }
+
+    // otherwise the chunk is rebased, events from the past are stored verbatim
+    static bool FitsChunk(const Chunk& chunk, const Event& event) {
+        if (chunk.End == 0) {
+            return true;
+        }
+        int64_t idDelta = (int64_t)(event.Id - chunk.BackId);
+        return event.StageStarted - chunk.BaseTs < (SimTime)VerbatimDelta
+            && idDelta >= MinIdDelta && idDelta <= MaxIdDelta;
+    }
+
+    static size_t GetIdDelta(const Chunk& chunk, size_t index) {
+        // arithmetic shift restores the sign
+        return (size_t)((int64_t)chunk.AgeRouteAndId[index] >> (AgeBits + RouteBits));
+    }
+
+    // sets everything except the id delta
+    bool Encode(Chunk& chunk, size_t index, const Event& event) {
+        SimTime delta = event.StageStarted - chunk.BaseTs;
+        SimTime age = event.StageStarted - event.StartTime;
+        if (delta < 0 || delta >= VerbatimDelta || age < 0 || (uint64_t)age > MaxAge) {
+            return false;
+        }
+
+        Route route{event.SrcId, event.DstId};
+        auto it = RouteIndex.find(route);
+        if (it == RouteIndex.end()) {
+            if (Routes.size() == MaxRoutes) {
+                return false;
+            }
+            it = RouteIndex.emplace(route, Routes.size()).first;
+            Routes.push_back(route);
+        }
+
+        chunk.StageDelta[index] = (uint32_t)delta;
+        chunk.AgeRouteAndId[index] = (uint64_t)age | (it->second << AgeBits);
+        return true;
+    }
+
+    Event Decode(const Chunk& chunk, size_t index, size_t id) const {
+        SimTime stageStarted = chunk.BaseTs + chunk.StageDelta[index];
+        SimTime age = (SimTime)(chunk.AgeRouteAndId[index] & MaxAge);
+        const auto& route = Routes[(chunk.AgeRouteAndId[index] >> AgeBits) & (MaxRoutes - 1)];
+
+        Event event(id, stageStarted - age, stageStarted);
+        event.SrcId = route.first;
+        event.DstId = route.second;
+        return event;
+    }
+
+private:
+    std::deque<std::unique_ptr<Chunk>> Chunks;
+    std::unique_ptr<Chunk> SpareChunk;
+    size_t Count = 0; // without the removed events
+
+    // removed, but not yet popped events
+    std::set<size_t> RemovedIds;
+
+    // src/dst of the events, they are few: tenants or nodes
+    std::vector<Route> Routes;
+    std::map<Route, uint64_t> RouteIndex;
+};
+
 // ----------------------------
 // Queue
 
-class Queue : public ItemBase {
+class Queue final : public ItemBase {
 public:
     Queue(const char* name, size_t initialEvents = 0)
         : Name(name)
@@ -203,7 +716,11 @@ public:
         }
     }
 
-    void Tick(double dt) override {
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime) override {
         /* do nothing */
     }
 
@@ -214,21 +731,46 @@ public:
 
     void PushEvent(Event event) override {
         event.StartStage();
-        Events.push_back(event);
+        Events.PushBack(event);
     }
 
     bool IsReadyToPopEvent() const override {
-        return !Events.empty();
+        return !Events.Empty() && !Fault.BlocksPop();
     }
 
     Event PopEvent() override {
-        Event event = Events.front();
-        QueueTimeUs.AddDuration((int)(event.GetStageDuration() * 1000000));
+        Event event = Events.Front();
+        QueueTimeUs.AddTime(event.GetStageDuration());
 
-        Events.pop_front();
+        Events.PopFront();
         return event;
     }
 
+    bool CancelEvent(size_t id) override {
+        return Events.Remove(id);
+    }
+
+    size_t GetEventCount() const override {
+        return Events.Size();
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        writer.Write(Events.Size());
+        Events.ForEach([&writer](const Event& event) {
+            event.Save(writer);
+        });
+        QueueTimeUs.Save(writer);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        Events.Clear();
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            Events.PushBack(Event::Load(reader));
+        }
+        QueueTimeUs.Load(reader);
+    }
+
 public:
     void Draw(arctic::Sprite toSprite) override {
         auto width = toSprite.Width();
@@ -251,7 +793,7 @@ public:
         // draw queue length in the middle
 
         char text[128];
-        auto queueLengthS = NumToStrWithSuffix(Events.size());
+        auto queueLengthS = NumToStrWithSuffix(Events.Size());
 
         snprintf(text, sizeof(text), "%s: %s\np90: %d us",
                  Name, queueLengthS.c_str(), QueueTimeUs.GetPercentile(90));
@@ -260,7 +802,7 @@ public:
 
 private:
     const char* Name;
-    std::deque<Event> Events;
+    EventStorage Events;
     Histogram QueueTimeUs;
 };
 
@@ -273,7 +815,7 @@ public:
         IdleStartTime = Now();
     }
 
-    virtual void Tick(double dt) = 0;
+    virtual void Tick(SimTime dt) = 0;
 
     virtual void StartWork(Event event) {
         _Event = event;
@@ -291,6 +833,13 @@ public:
         return _IsWorking || _IsEventReady;
     }
 
+    // work in progress doesn't advance for the given time
+    void Postpone(SimTime delay) {
+        if (_IsWorking) {
+            StartTime += delay;
+        }
+    }
+
     bool IsWorking() const
     {
         return _IsWorking;
@@ -301,6 +850,10 @@ public:
         return _IsEventReady;
     }
 
+    SimTime GetFinishTime() const {
+        return FinishTime;
+    }
+
     void Reset() {
         _IsWorking = false;
         _IsEventReady = false;
@@ -321,13 +874,23 @@ public:
         return event;
     }
 
+    bool HasEvent(size_t id) const {
+        return _Event && _Event->GetId() == id;
+    }
+
+    // drops the event, the time spent on it is still busy time
+    void Cancel() {
+        BusyTime += Now() - BusyStartTime;
+        Reset();
+    }
+
     void ResetBusyIdleTime()
     {
         BusyTime = 0;
         IdleTime = 0;
     }
 
-    double GetBusyTime()
+    SimTime GetBusyTime()
     {
         if (BusyStartTime != 0) {
             BusyTime += Now() - BusyStartTime;
@@ -337,7 +900,39 @@ public:
         return BusyTime;
     }
 
-    double GetIdleTime()
+    virtual void SaveState(SnapshotWriter& writer) const {
+        writer.Write(_IsWorking);
+        writer.Write(_IsEventReady);
+        writer.Write(StartTime);
+        writer.Write(FinishTime);
+        writer.Write(BusyStartTime);
+        writer.Write(IdleStartTime);
+        writer.Write(BusyTime);
+        writer.Write(IdleTime);
+
+        writer.Write(_Event.has_value());
+        if (_Event) {
+            _Event->Save(writer);
+        }
+    }
+
+    virtual void LoadState(SnapshotReader& reader) {
+        reader.Read(_IsWorking);
+        reader.Read(_IsEventReady);
+        reader.Read(StartTime);
+        reader.Read(FinishTime);
+        reader.Read(BusyStartTime);
+        reader.Read(IdleStartTime);
+        reader.Read(BusyTime);
+        reader.Read(IdleTime);
+
+        _Event.reset();
+        if (reader.Read<bool>()) {
+            _Event = Event::Load(reader);
+        }
+    }
+
+    SimTime GetIdleTime()
     {
         if (IdleStartTime != 0) {
             IdleTime += Now() - IdleStartTime;
@@ -353,14 +948,14 @@ protected:
     bool _IsWorking = false; // might be false, but with event, when ready to pop
     bool _IsEventReady = false;
 
-    double StartTime = 0;
-    double FinishTime = 0;
+    SimTime StartTime = 0;
+    SimTime FinishTime = 0;
 
-    double BusyStartTime = 0;
-    double IdleStartTime = 0;
+    SimTime BusyStartTime = 0;
+    SimTime IdleStartTime = 0;
 
-    double BusyTime = 0;
-    double IdleTime = 0;
+    SimTime BusyTime = 0;
+    SimTime IdleTime = 0;
 
     std::optional<Event> _Event;
 };
@@ -368,14 +963,14 @@ protected:
 // ----------------------------
 // FixedTimeProcessor
 
-class FixedTimeProcessor : public ProcessorBase {
+class FixedTimeProcessor final : public ProcessorBase {
 public:
-    FixedTimeProcessor(double executionTime)
+    FixedTimeProcessor(SimTime executionTime)
         : ExecutionTime(executionTime)
     {
     }
 
-    void Tick(double) override {
+    void Tick(SimTime) override {
         if (_IsWorking) {
             auto now = Now();
             if (now - StartTime >= ExecutionTime) {
@@ -386,25 +981,24 @@ public:
         }
     }
 private:
-    double ExecutionTime;
+    SimTime ExecutionTime;
 };
 
 // ----------------------------
 // PercentileTimeProcessor
 
-class PercentileTimeProcessor : public ProcessorBase {
+class PercentileTimeProcessor final : public ProcessorBase {
 public:
     struct Percentile {
         double Percentile = 0;
-        double Value = 0;
+        SimTime Value = 0;
     };
 
     using Percentiles = std::vector<Percentile>;
 
     PercentileTimeProcessor(Percentiles percentiles)
         : _Percentiles(std::move(percentiles))
-        , Rd(std::make_unique<std::random_device>())
-        , Gen(std::make_unique<std::mt19937>((*Rd)()))
+        , Gen(std::make_unique<std::mt19937>(NewRandomSeed()))
         , Dis(std::make_unique<std::uniform_real_distribution<>>(0, 100))
     {
         if (_Percentiles.empty()) {
@@ -415,21 +1009,35 @@ public:
     PercentileTimeProcessor(const PercentileTimeProcessor& other) = delete;
     PercentileTimeProcessor(PercentileTimeProcessor&& other) = default;
 
-    void StartWork(Event event) override {
-        ProcessorBase::StartWork(event);
-
-        double r = (*Dis)(*Gen);
-        for (auto& percentile: _Percentiles) {
+    // r is a uniformly distributed value in [0, 100)
+    static SimTime Sample(const Percentiles& percentiles, double r) {
+        for (auto& percentile: percentiles) {
             if (r < percentile.Percentile) {
-                ExecutionTime = percentile.Value;
-                return;
+                return percentile.Value;
             }
         }
 
-        ExecutionTime = _Percentiles.back().Value;
+        return percentiles.back().Value;
+    }
+
+    void StartWork(Event event) override {
+        ProcessorBase::StartWork(event);
+        ExecutionTime = Sample(_Percentiles, (*Dis)(*Gen));
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        ProcessorBase::SaveState(writer);
+        writer.Write(ExecutionTime);
+        writer.WriteRandomEngine(*Gen);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        ProcessorBase::LoadState(reader);
+        reader.Read(ExecutionTime);
+        reader.ReadRandomEngine(*Gen);
     }
 
-    void Tick(double) override {
+    void Tick(SimTime) override {
         if (_IsWorking) {
             auto now = Now();
             if (now - StartTime >= ExecutionTime) {
@@ -442,45 +1050,62 @@ public:
 
 private:
     Percentiles _Percentiles;
-    std::unique_ptr<std::random_device> Rd;
     std::unique_ptr<std::mt19937> Gen;
     std::unique_ptr<std::uniform_real_distribution<>> Dis;
 
-    double ExecutionTime;
+    SimTime ExecutionTime = 0;
 };
 
 // ----------------------------
 // Executor: wraps any processor into Item
 
 template <typename ProcessorType>
-class Executor : public ItemBase {
+class Executor final : public ItemBase {
 public:
 
     template<typename... Args>
     Executor(const char* name, size_t processorCount, Args&&... args)
         : Name(name)
         , BusyProcessorCount(0)
+        , ServiceTimeUs(Histogram::HistogramWithUsBuckets())
     {
+        // not forwarded: a moved argument would be empty for the following processors
         for (size_t i = 0; i < processorCount; ++i) {
-            Processors.emplace_back(std::forward<Args>(args)...);
+            Processors.emplace_back(args...);
         }
     }
 
-    void Tick(double dt) override {
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime dt) override {
         BusyProcessorCount = 0;
         ReadyEventsCount = 0;
 
-        double totalBusyTime = 0;
-        double totalIdleTime = 0;
+        SimTime totalBusyTime = 0;
+        SimTime totalIdleTime = 0;
 
-        bool updateLastAvg = (Now() - LastLoadAvgUpdateTs) * 1000'000 >= LoadAvgIntervalUsec;
+        bool updateLastAvg = Now() - LastLoadAvgUpdateTs >= LoadAvgInterval;
+
+        // lost processors are the last ones, they are always busy
+        auto availableCount = GetAvailableProcessorCount();
+        auto lostTime = Fault.GetLostTime(dt);
+
+        for (size_t i = 0; i < Processors.size(); ++i) {
+            auto& processor = Processors[i];
+            bool isAvailable = i < availableCount;
+            if (!isAvailable) {
+                processor.Postpone(dt);
+            } else if (lostTime != 0) {
+                processor.Postpone(lostTime);
+            }
 
-        for (auto& processor: Processors) {
             processor.Tick(dt);
-            if (processor.IsBusy()) {
+            if (processor.IsBusy() || !isAvailable) {
                 ++BusyProcessorCount;
             }
-            if (processor.IsEventReady()) {
+            if (processor.IsEventReady() && isAvailable) {
                 ++ReadyEventsCount;
             }
             if (updateLastAvg) {
@@ -491,13 +1116,13 @@ public:
         }
 
         if (updateLastAvg) {
-            LastLoadAvg = totalBusyTime / (totalBusyTime + totalIdleTime);
+            LastLoadAvg = (double)totalBusyTime / (totalBusyTime + totalIdleTime);
             LastLoadAvgUpdateTs = Now();
         }
     }
 
     bool IsReadyToPushEvent() const override {
-        return BusyProcessorCount < Processors.size();
+        return BusyProcessorCount < Processors.size() && !Fault.Stalled;
     }
 
     void PushEvent(Event event) override {
@@ -507,7 +1132,9 @@ public:
 
         event.StartStage();
 
-        for (auto& processor: Processors) {
+        auto availableCount = GetAvailableProcessorCount();
+        for (size_t i = 0; i < availableCount; ++i) {
+            auto& processor = Processors[i];
             if (!processor.IsBusy()) {
                 processor.StartWork(event);
                 if (processor.IsBusy()) {
@@ -519,7 +1146,7 @@ public:
     }
 
     bool IsReadyToPopEvent() const override {
-        return ReadyEventsCount > 0;
+        return ReadyEventsCount > 0 && !Fault.BlocksPop();
     }
 
     Event PopEvent() override {
@@ -527,21 +1154,91 @@ public:
             throw std::runtime_error("No events ready");
         }
 
-        for (auto& processor: Processors) {
+        auto availableCount = GetAvailableProcessorCount();
+        for (size_t i = 0; i < availableCount; ++i) {
+            auto& processor = Processors[i];
             if (processor.IsEventReady()) {
                 --ReadyEventsCount;
                 --BusyProcessorCount;
-                return processor.PopEvent();
+                auto finishTime = processor.GetFinishTime();
+                auto event = processor.PopEvent();
+                ServiceTimeUs.AddTime(finishTime - event.GetStageStartTime());
+                return event;
             }
         }
 
         throw std::runtime_error("No events ready");
     }
 
+    bool CancelEvent(size_t id) override {
+        auto availableCount = GetAvailableProcessorCount();
+        for (size_t i = 0; i < Processors.size(); ++i) {
+            auto& processor = Processors[i];
+            if (!processor.HasEvent(id)) {
+                continue;
+            }
+
+            // lost processors stay busy till the next tick
+            if (i < availableCount) {
+                if (processor.IsEventReady()) {
+                    --ReadyEventsCount;
+                }
+                --BusyProcessorCount;
+            }
+
+            processor.Cancel();
+            return true;
+        }
+
+        return false;
+    }
+
+    size_t GetEventCount() const override {
+        size_t count = 0;
+        for (const auto& processor: Processors) {
+            count += processor.IsBusy();
+        }
+        return count;
+    }
+
+    const Histogram* GetServiceTimeUs() const override {
+        return &ServiceTimeUs;
+    }
+
     size_t GetProcessorCount() const {
         return Processors.size();
     }
 
+    size_t GetAvailableProcessorCount() const {
+        return Processors.size() - std::min(Fault.LostProcessors, Processors.size());
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        writer.Write(Processors.size());
+        for (const auto& processor: Processors) {
+            processor.SaveState(writer);
+        }
+        writer.Write(BusyProcessorCount);
+        writer.Write(ReadyEventsCount);
+        writer.Write(LastLoadAvgUpdateTs);
+        writer.Write(LastLoadAvg);
+        ServiceTimeUs.Save(writer);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        if (reader.Read<size_t>() != Processors.size()) {
+            throw std::runtime_error("Executor in snapshot has different number of processors");
+        }
+        for (auto& processor: Processors) {
+            processor.LoadState(reader);
+        }
+        reader.Read(BusyProcessorCount);
+        reader.Read(ReadyEventsCount);
+        reader.Read(LastLoadAvgUpdateTs);
+        reader.Read(LastLoadAvg);
+        ServiceTimeUs.Load(reader);
+    }
+
     size_t GetBusyProcessorCount() const {
         return BusyProcessorCount;
     }
@@ -593,8 +1290,10 @@ private:
     size_t BusyProcessorCount = 0;
     size_t ReadyEventsCount = 0;
 
-    double LastLoadAvgUpdateTs = 0;
+    SimTime LastLoadAvgUpdateTs = 0;
     double LastLoadAvg = 0;
+
+    Histogram ServiceTimeUs;
 };
 
 } // namespace queue_sim
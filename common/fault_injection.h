@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Fault injection: timed or random episodes of degradation applied to stages.
+//
+//  * Slowdown: service time of executors and NVMe devices is multiplied;
+//  * Stall: the stage neither progresses nor releases events (e.g. a thread
+//    stalled by a page fault);
+//  * ProcessorLoss: some processors of an executor neither progress nor take events;
+//  * Freeze: the stage accepts events, but doesn't release them.
+//
+// The injector also classifies finished events: an event is affected, when it was
+// intended to start during an episode or before the system has recovered from it.
+// The system has recovered, when a window of consecutive events intended to start after
+// the episode end finish not slower than p99 of unaffected events. Latencies are from
+// the intended start, i.e. the pipeline should run with the intended rate, otherwise
+// a closed loop hides the queueing behind the episode (coordinated omission). The report
+// shows recovery times and the share of the tail caused by episodes.
+
+namespace queue_sim {
+
+enum class EFault {
+    Slowdown,
+    Stall,
+    ProcessorLoss,
+    Freeze,
+};
+
+struct FaultEpisode {
+    EFault Kind = EFault::Stall;
+    SimTime Start = 0;
+    SimTime Duration = 0;
+
+    double Multiplier = 10;     // Slowdown only
+    size_t LostProcessors = 1;  // ProcessorLoss only
+};
+
+// ----------------------------
+// FaultInjector
+
+class FaultInjector {
+private:
+    static constexpr SimTime Never = std::numeric_limits<SimTime>::max();
+
+    enum class EState {
+        Pending,
+        Active,
+        Recovering,
+        Recovered,
+    };
+
+    struct ScheduledEpisode {
+        ItemBase* Stage;
+        FaultEpisode Episode;
+        EState State = EState::Pending;
+        SimTime RecoveredTs = Never;
+
+        // consecutive events within the baseline, since the first of them has finished
+        size_t GoodEvents = 0;
+        SimTime GoodSinceTs = Never;
+
+        SimTime GetEndTs() const {
+            return Episode.Start + Episode.Duration;
+        }
+    };
+
+public:
+    // recoveryWindow: consecutive events within the baseline, which mean the recovery
+    explicit FaultInjector(size_t recoveryWindow = 100)
+        : RecoveryWindow(std::max<size_t>(recoveryWindow, 1))
+        , AffectedDurationsUs(Histogram::HistogramWithUsBuckets())
+        , UnaffectedDurationsUs(Histogram::HistogramWithUsBuckets())
+        , Gen(std::make_unique<std::mt19937>(NewRandomSeed()))
+    {
+    }
+
+    void AddEpisode(ItemBase* stage, FaultEpisode episode) {
+        if (episode.Start < Now()) {
+            throw std::runtime_error("Episode must not start in the past");
+        }
+        if (episode.Kind == EFault::Slowdown && episode.Multiplier < 1) {
+            throw std::runtime_error("Slowdown multiplier must be at least 1");
+        }
+
+        // episodes are ordered by start, thus started ones are a prefix
+        auto it = std::upper_bound(Episodes.begin(), Episodes.end(), episode.Start,
+            [](SimTime start, const ScheduledEpisode& other) {
+                return start < other.Episode.Start;
+            });
+        Episodes.insert(it, ScheduledEpisode{stage, episode});
+
+        NextChangeTs = std::min(NextChangeTs, episode.Start);
+    }
+
+    // episodes like the given one, starting at random (Poisson) moments within [from, until)
+    void AddRandomEpisodes(ItemBase* stage, FaultEpisode episode, SimTime meanInterval, SimTime from, SimTime until) {
+        std::exponential_distribution<> interval(1.0 / meanInterval);
+        for (SimTime start = from + (SimTime)interval(*Gen); start < until; start += (SimTime)interval(*Gen)) {
+            episode.Start = start;
+            AddEpisode(stage, episode);
+        }
+    }
+
+    // must be called before ticking the stages
+    void Tick() {
+        auto now = Now();
+        if (now < NextChangeTs) {
+            return;
+        }
+
+        NextChangeTs = Never;
+        while (StartedCount < Episodes.size() && Episodes[StartedCount].Episode.Start <= now) {
+            auto& episode = Episodes[StartedCount++];
+            episode.State = EState::Active;
+            ApplyFaults(episode.Stage);
+        }
+
+        for (size_t i = FirstUnrecovered; i < StartedCount; ++i) {
+            auto& episode = Episodes[i];
+            if (episode.State != EState::Active) {
+                continue;
+            }
+
+            if (episode.GetEndTs() <= now) {
+                episode.State = EState::Recovering;
+                ++RecoveringCount;
+                ApplyFaults(episode.Stage);
+            } else {
+                NextChangeTs = std::min(NextChangeTs, episode.GetEndTs());
+            }
+        }
+
+        if (StartedCount < Episodes.size()) {
+            NextChangeTs = std::min(NextChangeTs, Episodes[StartedCount].Episode.Start);
+        }
+    }
+
+    // to be called for each finished event, see ClosedPipeLine::AddEventFinishedCallback
+    void OnEventFinished(const Event& event, SimTime intendedStart) {
+        auto now = Now();
+        auto duration = now - intendedStart;
+
+        // i.e. there is an episode, which hasn't finished or recovered before the intended start
+        bool isAffected = FirstUnrecovered < StartedCount || LastRecoveredTs >= intendedStart;
+
+        if (RecoveringCount > 0) {
+            // baseline is defined by the events, which have not been affected so far
+            SimTime baseline = UnaffectedEvents ? UnaffectedDurationsUs.GetPercentile(99) * Usec : Never;
+            for (size_t i = FirstUnrecovered; i < StartedCount; ++i) {
+                auto& episode = Episodes[i];
+                if (episode.State != EState::Recovering || intendedStart < episode.GetEndTs()) {
+                    continue;
+                }
+
+                if (duration > baseline) {
+                    episode.GoodEvents = 0;
+                    continue;
+                }
+
+                if (episode.GoodEvents++ == 0) {
+                    episode.GoodSinceTs = now;
+                }
+                if (episode.GoodEvents >= RecoveryWindow) {
+                    episode.State = EState::Recovered;
+                    episode.RecoveredTs = episode.GoodSinceTs;
+                    LastRecoveredTs = std::max(LastRecoveredTs, episode.GoodSinceTs);
+                    --RecoveringCount;
+                    RecoveryTimes.push_back(episode.GoodSinceTs - episode.GetEndTs());
+                }
+            }
+
+            while (FirstUnrecovered < StartedCount && Episodes[FirstUnrecovered].State == EState::Recovered) {
+                ++FirstUnrecovered;
+            }
+        }
+
+        if (isAffected) {
+            AffectedDurationsUs.AddTime(duration);
+            ++AffectedEvents;
+        } else {
+            UnaffectedDurationsUs.AddTime(duration);
+            ++UnaffectedEvents;
+        }
+    }
+
+    const std::vector<SimTime>& GetRecoveryTimes() const {
+        return RecoveryTimes;
+    }
+
+    std::string GetReportText() {
+        auto totalUs = Histogram::HistogramWithUsBuckets();
+        totalUs.Merge(AffectedDurationsUs);
+        totalUs.Merge(UnaffectedDurationsUs);
+
+        SimTime maxRecovery = 0;
+        SimTime sumRecovery = 0;
+        for (auto recovery: RecoveryTimes) {
+            maxRecovery = std::max(maxRecovery, recovery);
+            sumRecovery += recovery;
+        }
+        auto avgRecovery = RecoveryTimes.empty() ? 0 : sumRecovery / (SimTime)RecoveryTimes.size();
+
+        std::string result;
+        char text[512];
+        snprintf(text, sizeof(text),
+            "Episodes: %ld, started: %ld, recovered: %ld, recovery avg: %.2f ms, max: %.2f ms\n",
+            Episodes.size(), StartedCount, RecoveryTimes.size(),
+            (double)avgRecovery / Msec, (double)maxRecovery / Msec);
+        result += text;
+
+        snprintf(text, sizeof(text),
+            "Affected events: %ld, p50: %d us, p99: %d us; unaffected: %ld, p50: %d us, p99: %d us\n",
+            AffectedEvents, AffectedDurationsUs.GetPercentile(50), AffectedDurationsUs.GetPercentile(99),
+            UnaffectedEvents, UnaffectedDurationsUs.GetPercentile(50), UnaffectedDurationsUs.GetPercentile(99));
+        result += text;
+
+        for (int percentile: {90, 99}) {
+            auto threshold = totalUs.GetPercentile(percentile);
+            auto tail = totalUs.GetCountFrom(threshold);
+            auto affectedTail = AffectedDurationsUs.GetCountFrom(threshold);
+            snprintf(text, sizeof(text), "Events >= p%d (%d us): %d, caused by episodes: %.1f%%\n",
+                percentile, threshold, tail, tail ? 100.0 * affectedTail / tail : 0.0);
+            result += text;
+        }
+
+        return result;
+    }
+
+private:
+    // the stage's fault is the combination of all its active episodes
+    void ApplyFaults(ItemBase* stage) {
+        StageFault fault;
+        for (size_t i = FirstUnrecovered; i < StartedCount; ++i) {
+            const auto& scheduled = Episodes[i];
+            if (scheduled.Stage != stage || scheduled.State != EState::Active) {
+                continue;
+            }
+
+            const auto& episode = scheduled.Episode;
+            switch (episode.Kind) {
+            case EFault::Slowdown:
+                fault.ServiceTimeMultiplier = std::max(fault.ServiceTimeMultiplier, episode.Multiplier);
+                break;
+            case EFault::Stall:
+                fault.Stalled = true;
+                break;
+            case EFault::ProcessorLoss:
+                fault.LostProcessors += episode.LostProcessors;
+                break;
+            case EFault::Freeze:
+                fault.Frozen = true;
+                break;
+            }
+        }
+
+        stage->SetFault(fault);
+    }
+
+private:
+    const size_t RecoveryWindow;
+
+    std::vector<ScheduledEpisode> Episodes;
+    size_t StartedCount = 0;
+    SimTime NextChangeTs = Never;
+
+    // all episodes before it have recovered
+    size_t FirstUnrecovered = 0;
+    size_t RecoveringCount = 0;
+    SimTime LastRecoveredTs = std::numeric_limits<SimTime>::min();
+
+    std::vector<SimTime> RecoveryTimes;
+
+    size_t AffectedEvents = 0;
+    size_t UnaffectedEvents = 0;
+    Histogram AffectedDurationsUs;
+    Histogram UnaffectedDurationsUs;
+
+    std::unique_ptr<std::mt19937> Gen;
+};
+
+} // namespace queue_sim
@@ -0,0 +1,444 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include "engine/easy.h"
+#include "engine/easy_drawing.h"
+#include "engine/easy_sprite.h"
+
+#include "common.h"
+#include "simple_pipeline.h"
+
+// Hedged requests: an event is sent to one of the targets (e.g. replicas or devices),
+// when it isn't finished within the hedging delay, a duplicate is sent to the next
+// target. The first completion wins, the other copy is cancelled (or, when the target
+// can't cancel, its completion is dropped).
+
+namespace queue_sim {
+
+// ----------------------------
+// HedgingPolicy
+
+struct HedgingPolicy {
+    static constexpr SimTime Never = std::numeric_limits<SimTime>::max();
+
+    // the duplicate is issued, when the event isn't finished within the delay...
+    SimTime Delay = Never;
+
+    // ...or within the percentile of the observed latencies, when set. The percentile
+    // is exact over the sliding window of the last latencies: histogram buckets are too
+    // coarse, e.g. p90 and p99 might be the same bucket bound
+    double Percentile = 0;
+    size_t WindowSize = 1000;
+
+    static HedgingPolicy NoHedging() {
+        return {};
+    }
+
+    static HedgingPolicy AfterDelay(SimTime delay) {
+        return {delay, 0};
+    }
+
+    static HedgingPolicy AfterPercentile(double percentile, size_t windowSize = 1000) {
+        return {Never, percentile, windowSize};
+    }
+};
+
+// ----------------------------
+// HedgedExecutor
+
+// Targets get only a part of events, thus they must not have a flush controller
+class HedgedExecutor final : public ItemBase {
+private:
+    struct PendingEvent {
+        Event _Event;
+        SimTime PushTs = 0;
+        size_t Primary = 0;
+        bool Hedged = false;
+
+        // finished or cancelled, waits for the copies, which couldn't be cancelled
+        bool Done = false;
+        size_t Copies = 1;
+    };
+
+    using HedgeTs = std::pair<SimTime, size_t>; // ts and event id
+
+public:
+    using SetupTarget = std::function<void(StageChain& chain, size_t target)>;
+
+    HedgedExecutor(const char* name, size_t targetCount, HedgingPolicy policy, const SetupTarget& setupTarget)
+        : Name(name)
+        , Policy(policy)
+        , LatencyUs(Histogram::HistogramWithUsBuckets())
+    {
+        if (targetCount < 2) {
+            throw std::runtime_error("Hedging needs at least 2 targets");
+        }
+        if (Policy.Percentile < 0 || Policy.Percentile > 100) {
+            throw std::runtime_error("Hedging percentile must be between 0 and 100");
+        }
+        if (Policy.Percentile != 0 && Policy.WindowSize == 0) {
+            throw std::runtime_error("Hedging percentile needs a window");
+        }
+
+        for (size_t i = 0; i < targetCount; ++i) {
+            Targets.emplace_back(std::make_unique<StageChain>());
+            setupTarget(*Targets.back(), i);
+            if (Targets.back()->GetStageCount() == 0) {
+                throw std::runtime_error("Target must have stages");
+            }
+        }
+    }
+
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime dt) override {
+        for (size_t i = 0; i < Targets.size(); ++i) {
+            auto& target = *Targets[i];
+            target.Tick(dt);
+
+            auto& lastStage = target.Back();
+            while (lastStage.IsReadyToPopEvent()) {
+                OnCompletion(i, lastStage.PopEvent());
+            }
+        }
+
+        IssueHedges();
+    }
+
+    bool IsReadyToPushEvent() const override {
+        return Targets[NextTarget]->Front().IsReadyToPushEvent() && !Fault.Stalled;
+    }
+
+    void PushEvent(Event event) override {
+        event.StartStage();
+
+        auto primary = NextTarget;
+        NextTarget = (NextTarget + 1) % Targets.size();
+
+        auto now = Now();
+        Pending.emplace(event.GetId(), PendingEvent{event, now, primary});
+        Targets[primary]->Front().PushEvent(event);
+        ++PushedEvents;
+
+        auto delay = GetHedgeDelay();
+        if (delay != HedgingPolicy::Never) {
+            HedgeQueue.push({now + delay, event.GetId()});
+        }
+    }
+
+    bool IsReadyToPopEvent() const override {
+        return !Finished.empty() && !Fault.BlocksPop();
+    }
+
+    Event PopEvent() override {
+        if (!IsReadyToPopEvent()) {
+            throw std::runtime_error("No events ready");
+        }
+
+        auto event = Finished.front();
+        Finished.pop_front();
+        return event;
+    }
+
+    bool CancelEvent(size_t id) override {
+        auto finishedIt = std::find_if(Finished.begin(), Finished.end(),
+            [id](const Event& event) { return event.GetId() == id; });
+        bool wasFinished = finishedIt != Finished.end();
+        if (wasFinished) {
+            Finished.erase(finishedIt);
+        }
+
+        auto it = Pending.find(id);
+        if (it == Pending.end() || it->second.Done) {
+            return wasFinished;
+        }
+
+        auto& pending = it->second;
+        pending.Done = true;
+        CancelCopy(pending, pending.Primary);
+        if (pending.Hedged) {
+            CancelCopy(pending, GetHedgeTarget(pending));
+        }
+
+        if (pending.Copies == 0) {
+            Pending.erase(it);
+        }
+
+        return true;
+    }
+
+    // events waiting for the first completion and finished ones
+    size_t GetEventCount() const override {
+        size_t count = Finished.size();
+        for (const auto& [id, pending]: Pending) {
+            count += !pending.Done;
+        }
+        return count;
+    }
+
+    const Histogram* GetServiceTimeUs() const override {
+        return &LatencyUs;
+    }
+
+    // time to the first completion
+    const Histogram& GetLatencyUs() const {
+        return LatencyUs;
+    }
+
+    // extra load: duplicates per event
+    double GetHedgedShare() const {
+        return PushedEvents ? (double)HedgedEvents / PushedEvents : 0;
+    }
+
+    // how often the duplicate has finished first
+    double GetHedgeWinShare() const {
+        return HedgedEvents ? (double)HedgeWins / HedgedEvents : 0;
+    }
+
+    // the current one, for the percentile policy it follows the observed latencies
+    SimTime GetCurrentHedgeDelay() const {
+        return Policy.Percentile ? PercentileDelay : Policy.Delay;
+    }
+
+    // copies, which have been processed till the end, although the event was already done
+    size_t GetWastedCopies() const {
+        return WastedCopies;
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        for (const auto& target: Targets) {
+            target->SaveStages(writer);
+        }
+        writer.Write(NextTarget);
+
+        writer.Write(Pending.size());
+        for (const auto& [id, pending]: Pending) {
+            pending._Event.Save(writer);
+            writer.Write(pending.PushTs);
+            writer.Write(pending.Primary);
+            writer.Write(pending.Hedged);
+            writer.Write(pending.Done);
+            writer.Write(pending.Copies);
+        }
+
+        auto hedgeQueue = HedgeQueue;
+        writer.Write(hedgeQueue.size());
+        while (!hedgeQueue.empty()) {
+            writer.Write(hedgeQueue.top().first);
+            writer.Write(hedgeQueue.top().second);
+            hedgeQueue.pop();
+        }
+
+        writer.Write(Finished.size());
+        for (const auto& event: Finished) {
+            event.Save(writer);
+        }
+
+        LatencyUs.Save(writer);
+        writer.Write(RecentLatencies.size());
+        for (auto latency: RecentLatencies) {
+            writer.Write(latency);
+        }
+        writer.Write(PercentileDelay);
+        writer.Write(WindowUpdates);
+        writer.Write(PushedEvents);
+        writer.Write(CompletedEvents);
+        writer.Write(HedgedEvents);
+        writer.Write(HedgeWins);
+        writer.Write(WastedCopies);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        for (auto& target: Targets) {
+            target->LoadStages(reader);
+        }
+        reader.Read(NextTarget);
+
+        Pending.clear();
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            PendingEvent pending{Event::Load(reader)};
+            reader.Read(pending.PushTs);
+            reader.Read(pending.Primary);
+            reader.Read(pending.Hedged);
+            reader.Read(pending.Done);
+            reader.Read(pending.Copies);
+            Pending.emplace(pending._Event.GetId(), pending);
+        }
+
+        HedgeQueue = {};
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto ts = reader.Read<SimTime>();
+            HedgeQueue.push({ts, reader.Read<size_t>()});
+        }
+
+        Finished.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            Finished.push_back(Event::Load(reader));
+        }
+
+        LatencyUs.Load(reader);
+        RecentLatencies.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            RecentLatencies.push_back(reader.Read<SimTime>());
+        }
+        reader.Read(PercentileDelay);
+        reader.Read(WindowUpdates);
+        reader.Read(PushedEvents);
+        reader.Read(CompletedEvents);
+        reader.Read(HedgedEvents);
+        reader.Read(HedgeWins);
+        reader.Read(WastedCopies);
+    }
+
+public:
+    void Draw(arctic::Sprite toSprite) override {
+        char text[256];
+        snprintf(text, sizeof(text), "%s: %ld\np90: %d us\nHedged: %.2f%%",
+            Name, Pending.size(), LatencyUs.GetPercentile(90), 100 * GetHedgedShare());
+        GetFont().Draw(toSprite, text, 5, toSprite.Height() / 2);
+    }
+
+private:
+    size_t GetHedgeTarget(const PendingEvent& pending) const {
+        return (pending.Primary + 1) % Targets.size();
+    }
+
+    SimTime GetHedgeDelay() {
+        if (Policy.Percentile == 0) {
+            return Policy.Delay;
+        }
+
+        // till there are observations, there is nothing to compare with
+        if (RecentLatencies.empty()) {
+            return HedgingPolicy::Never;
+        }
+
+        // selection is linear in the window, thus the delay is refreshed only
+        // after a part of the window has been replaced
+        if (PercentileDelay == HedgingPolicy::Never || WindowUpdates >= std::max<size_t>(Policy.WindowSize / 16, 1)) {
+            std::vector<SimTime> latencies(RecentLatencies.begin(), RecentLatencies.end());
+            size_t index = std::min(latencies.size() - 1, (size_t)(latencies.size() * Policy.Percentile / 100));
+            std::nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+            PercentileDelay = latencies[index];
+            WindowUpdates = 0;
+        }
+
+        return PercentileDelay;
+    }
+
+    void AddRecentLatency(SimTime latency) {
+        if (Policy.Percentile == 0) {
+            return;
+        }
+
+        RecentLatencies.push_back(latency);
+        if (RecentLatencies.size() > Policy.WindowSize) {
+            RecentLatencies.pop_front();
+        }
+        ++WindowUpdates;
+    }
+
+    void IssueHedges() {
+        auto now = Now();
+        while (!HedgeQueue.empty() && HedgeQueue.top().first <= now) {
+            auto it = Pending.find(HedgeQueue.top().second);
+            if (it == Pending.end() || it->second.Done || it->second.Hedged) {
+                HedgeQueue.pop();
+                continue;
+            }
+
+            auto& pending = it->second;
+            auto& target = Targets[GetHedgeTarget(pending)]->Front();
+            if (!target.IsReadyToPushEvent()) {
+                // wait for a free slot
+                break;
+            }
+
+            HedgeQueue.pop();
+            pending.Hedged = true;
+            ++pending.Copies;
+            ++HedgedEvents;
+            target.PushEvent(pending._Event);
+        }
+    }
+
+    void CancelCopy(PendingEvent& pending, size_t target) {
+        if (Targets[target]->CancelEvent(pending._Event.GetId())) {
+            --pending.Copies;
+        }
+    }
+
+    void OnCompletion(size_t target, const Event& event) {
+        auto it = Pending.find(event.GetId());
+        if (it == Pending.end()) {
+            throw std::runtime_error("Target finished unknown event");
+        }
+
+        auto& pending = it->second;
+        --pending.Copies;
+
+        if (pending.Done) {
+            ++WastedCopies;
+        } else {
+            pending.Done = true;
+            ++CompletedEvents;
+            LatencyUs.AddTime(Now() - pending.PushTs);
+            AddRecentLatency(Now() - pending.PushTs);
+            Finished.push_back(pending._Event);
+
+            if (pending.Hedged) {
+                if (target != pending.Primary) {
+                    ++HedgeWins;
+                    CancelCopy(pending, pending.Primary);
+                } else {
+                    CancelCopy(pending, GetHedgeTarget(pending));
+                }
+            }
+        }
+
+        if (pending.Copies == 0) {
+            Pending.erase(it);
+        }
+    }
+
+private:
+    const char* Name;
+    HedgingPolicy Policy;
+
+    std::vector<std::unique_ptr<StageChain>> Targets;
+    size_t NextTarget = 0;
+
+    // events, which have copies in the targets
+    std::map<size_t, PendingEvent> Pending;
+    std::priority_queue<HedgeTs, std::vector<HedgeTs>, std::greater<HedgeTs>> HedgeQueue;
+    std::deque<Event> Finished;
+
+    Histogram LatencyUs;
+
+    // for the percentile policy
+    std::deque<SimTime> RecentLatencies;
+    SimTime PercentileDelay = HedgingPolicy::Never;
+    size_t WindowUpdates = 0;
+
+    size_t PushedEvents = 0;
+    size_t CompletedEvents = 0;
+    size_t HedgedEvents = 0;
+    size_t HedgeWins = 0;
+    size_t WastedCopies = 0;
+};
+
+} // namespace queue_sim
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+// Bounded lock-free queues used to pass events between real threads
+
+namespace queue_sim {
+
+constexpr size_t CacheLineSize = 64;
+
+inline size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// ----------------------------
+// SpinWait: spin a bit before giving the CPU to other threads
+
+class SpinWait {
+public:
+    void Wait() {
+        if (++Iterations < SpinIterations) {
+            return;
+        }
+        std::this_thread::yield();
+    }
+
+    void Reset() {
+        Iterations = 0;
+    }
+
+private:
+    static constexpr size_t SpinIterations = 64;
+    size_t Iterations = 0;
+};
+
+// ----------------------------
+// SpscQueue: single producer, single consumer
+
+template <typename T>
+class SpscQueue {
+public:
+    SpscQueue(size_t capacity)
+        : Capacity(RoundUpToPowerOfTwo(capacity))
+        , Mask(Capacity - 1)
+        , Buffer(std::make_unique<T[]>(Capacity))
+    {
+    }
+
+    bool TryPush(const T& value) {
+        auto tail = Tail.load(std::memory_order_relaxed);
+        if (tail - Head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+
+        Buffer[tail & Mask] = value;
+        Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T& value) {
+        auto head = Head.load(std::memory_order_relaxed);
+        if (head == Tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        value = Buffer[head & Mask];
+        Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    const size_t Capacity;
+    const size_t Mask;
+    std::unique_ptr<T[]> Buffer;
+
+    alignas(CacheLineSize) std::atomic<size_t> Head{0};
+    alignas(CacheLineSize) std::atomic<size_t> Tail{0};
+};
+
+// ----------------------------
+// MpmcQueue: multiple producers, multiple consumers (D. Vyukov's bounded queue),
+// also used as MPSC and SPMC queue
+
+template <typename T>
+class MpmcQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> Sequence;
+        T Value;
+    };
+
+public:
+    MpmcQueue(size_t capacity)
+        : Mask(RoundUpToPowerOfTwo(std::max<size_t>(capacity, 2)) - 1)
+        , Cells(std::make_unique<Cell[]>(Mask + 1))
+    {
+        for (size_t i = 0; i <= Mask; ++i) {
+            Cells[i].Sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool TryPush(const T& value) {
+        auto pos = EnqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& cell = Cells[pos & Mask];
+            auto sequence = cell.Sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (EnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.Value = value;
+                    cell.Sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = EnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T& value) {
+        auto pos = DequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& cell = Cells[pos & Mask];
+            auto sequence = cell.Sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (DequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.Value;
+                    cell.Sequence.store(pos + Mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = DequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    const size_t Mask;
+    std::unique_ptr<Cell[]> Cells;
+
+    alignas(CacheLineSize) std::atomic<size_t> EnqueuePos{0};
+    alignas(CacheLineSize) std::atomic<size_t> DequeuePos{0};
+};
+
+// ----------------------------
+// MpscMailbox: unbounded, multiple producers, single consumer (D. Vyukov's intrusive queue)
+
+template <typename T>
+class MpscMailbox {
+private:
+    struct Node {
+        std::atomic<Node*> Next{nullptr};
+        std::optional<T> Value;
+    };
+
+public:
+    MpscMailbox()
+        : Head(&Stub)
+        , Tail(&Stub)
+    {
+    }
+
+    MpscMailbox(const MpscMailbox&) = delete;
+    MpscMailbox& operator=(const MpscMailbox&) = delete;
+
+    ~MpscMailbox() {
+        while (Tail) {
+            auto* next = Tail->Next.load(std::memory_order_relaxed);
+            if (Tail != &Stub) {
+                delete Tail;
+            }
+            Tail = next;
+        }
+    }
+
+    void Push(T value) {
+        auto* node = new Node();
+        node->Value.emplace(std::move(value));
+
+        auto* prev = Head.exchange(node, std::memory_order_acq_rel);
+        prev->Next.store(node, std::memory_order_release);
+    }
+
+    std::optional<T> TryPop() {
+        auto* tail = Tail;
+        auto* next = tail->Next.load(std::memory_order_acquire);
+        if (!next) {
+            return {};
+        }
+
+        // next becomes the new stub
+        std::optional<T> value = std::move(next->Value);
+        next->Value.reset();
+        Tail = next;
+
+        if (tail != &Stub) {
+            delete tail;
+        }
+        return value;
+    }
+
+private:
+    alignas(CacheLineSize) std::atomic<Node*> Head;
+    alignas(CacheLineSize) Node* Tail;
+    Node Stub;
+};
+
+} // namespace queue_sim
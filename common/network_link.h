@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "engine/easy.h"
+#include "engine/easy_drawing.h"
+#include "engine/easy_sprite.h"
+
+#include "common.h"
+
+// Network hop between two nodes. Messages are serialized onto the wire one
+// after another (bandwidth), then propagate through the network (latency).
+// Both latency and bandwidth are random.
+
+namespace queue_sim {
+
+// ----------------------------
+// NetworkLinkConfig
+
+// the same as PercentileTimeProcessor::Percentile, but the value is a rate, not a time
+struct BandwidthPercentile {
+    double Percentile = 0;
+    double BytesPerSecond = 0;
+};
+
+using BandwidthPercentiles = std::vector<BandwidthPercentile>;
+
+struct NetworkLinkConfig {
+    // one way latency of a message, which already is on the wire
+    PercentileTimeProcessor::Percentiles Latency = {
+        {50, 20 * Usec},
+        {99, 40 * Usec},
+        {100, 200 * Usec},
+    };
+
+    // effective bandwidth, sampled per message
+    BandwidthPercentiles Bandwidth = {
+        {100, 10e9 / 8},
+    };
+
+    size_t MessageBytes = 4096;
+};
+
+// ----------------------------
+// NetworkLink
+
+class NetworkLink final : public ItemBase {
+private:
+    struct Message {
+        Event _Event;
+        SimTime ArrivalTs;
+
+        // min-heap by arrival time, ties are broken by id to be deterministic
+        bool operator<(const Message& other) const {
+            if (ArrivalTs != other.ArrivalTs) {
+                return ArrivalTs > other.ArrivalTs;
+            }
+            return other._Event < _Event;
+        }
+    };
+
+public:
+    NetworkLink(const char* name, NetworkLinkConfig config)
+        : Name(name)
+        , Config(std::move(config))
+        , TransferTimeUs(Histogram::HistogramWithUsBuckets())
+        , Gen(std::make_unique<std::mt19937>(NewRandomSeed()))
+        , Dis(std::make_unique<std::uniform_real_distribution<>>(0, 100))
+    {
+        if (Config.Latency.empty() || Config.Bandwidth.empty()) {
+            throw std::runtime_error("Network link must have latency and bandwidth");
+        }
+        for (const auto& bandwidth: Config.Bandwidth) {
+            if (bandwidth.BytesPerSecond <= 0) {
+                throw std::runtime_error("Network link bandwidth must be positive");
+            }
+        }
+    }
+
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime) override {
+        /* do nothing */
+    }
+
+    bool IsReadyToPushEvent() const override {
+        // sender's socket buffer is infinite
+        return true;
+    }
+
+    void PushEvent(Event event) override {
+        event.StartStage();
+
+        auto bandwidth = SampleBandwidth((*Dis)(*Gen));
+        auto latency = PercentileTimeProcessor::Sample(Config.Latency, (*Dis)(*Gen));
+
+        auto sendStartTs = std::max(Now(), WireFreeTs);
+        WireFreeTs = sendStartTs + (SimTime)(Config.MessageBytes * (double)Sec / bandwidth);
+
+        InFlight.push({event, WireFreeTs + latency});
+    }
+
+    bool IsReadyToPopEvent() const override {
+        return !InFlight.empty() && InFlight.top().ArrivalTs <= Now() && !Fault.BlocksPop();
+    }
+
+    Event PopEvent() override {
+        if (!IsReadyToPopEvent()) {
+            throw std::runtime_error("No events ready");
+        }
+
+        auto event = InFlight.top()._Event;
+        auto arrivalTs = InFlight.top().ArrivalTs;
+        InFlight.pop();
+
+        // without the time the message has waited for the next stage
+        TransferTimeUs.AddTime(arrivalTs - event.GetStageStartTime());
+        ++DeliveredEvents;
+
+        return event;
+    }
+
+    size_t GetEventCount() const override {
+        return InFlight.size();
+    }
+
+    // from the send till the arrival, including the wait for the wire
+    const Histogram* GetServiceTimeUs() const override {
+        return &TransferTimeUs;
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        auto inFlight = InFlight;
+        writer.Write(inFlight.size());
+        while (!inFlight.empty()) {
+            inFlight.top()._Event.Save(writer);
+            writer.Write(inFlight.top().ArrivalTs);
+            inFlight.pop();
+        }
+
+        writer.Write(WireFreeTs);
+        writer.Write(DeliveredEvents);
+        TransferTimeUs.Save(writer);
+        writer.WriteRandomEngine(*Gen);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        InFlight = {};
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto event = Event::Load(reader);
+            InFlight.push({event, reader.Read<SimTime>()});
+        }
+
+        reader.Read(WireFreeTs);
+        reader.Read(DeliveredEvents);
+        TransferTimeUs.Load(reader);
+        reader.ReadRandomEngine(*Gen);
+    }
+
+public:
+    void Draw(arctic::Sprite toSprite) override {
+        char text[128];
+        snprintf(text, sizeof(text), "%s: %ld\np90: %d us",
+            Name, InFlight.size(), TransferTimeUs.GetPercentile(90));
+        GetFont().Draw(toSprite, text, 5, toSprite.Height() / 2);
+    }
+
+private:
+    // r is a uniformly distributed value in [0, 100)
+    double SampleBandwidth(double r) const {
+        for (const auto& bandwidth: Config.Bandwidth) {
+            if (r < bandwidth.Percentile) {
+                return bandwidth.BytesPerSecond;
+            }
+        }
+
+        return Config.Bandwidth.back().BytesPerSecond;
+    }
+
+private:
+    const char* Name;
+    NetworkLinkConfig Config;
+
+    std::priority_queue<Message> InFlight;
+    SimTime WireFreeTs = 0;
+
+    size_t DeliveredEvents = 0;
+    Histogram TransferTimeUs;
+
+    std::unique_ptr<std::mt19937> Gen;
+    std::unique_ptr<std::uniform_real_distribution<>> Dis;
+};
+
+} // namespace queue_sim
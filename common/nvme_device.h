@@ -0,0 +1,486 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "engine/easy.h"
+#include "engine/easy_drawing.h"
+#include "engine/easy_sprite.h"
+
+#include "common.h"
+
+// Stateful model of a single NVMe device. Unlike Executor<PercentileTimeProcessor>,
+// where every in-flight slot is an independent server, here all requests share
+// the internal parallelism of the device: channels and dies.
+
+namespace queue_sim {
+
+// ----------------------------
+// NVMeDeviceConfig
+
+struct NVMeDeviceConfig {
+    struct InflightPoint {
+        size_t Inflight = 0;
+        double Multiplier = 1;
+    };
+
+    // host side limit: number of requests the device accepts
+    size_t MaxInflight = 128;
+
+    // internal parallelism: each die executes one operation at a time,
+    // each channel transfers data of one operation at a time
+    size_t Channels = 8;
+    size_t DiesPerChannel = 4;
+
+    // fraction of requests, which are writes (PDisk mostly writes)
+    double WriteFraction = 1.0;
+
+    // die service times
+    PercentileTimeProcessor::Percentiles ReadPercentiles;
+    PercentileTimeProcessor::Percentiles WritePercentiles;
+
+    // time to transfer a block over the channel
+    SimTime ChannelTransferTime = 1 * Usec;
+
+    // die service time multiplier as a function of in-flight depth,
+    // linearly interpolated between the points, must be sorted by Inflight
+    std::vector<InflightPoint> LatencyCurve;
+
+    // read service time is multiplied by (1 + ReadWriteInterference * writeShare),
+    // where writeShare is the share of writes among in-flight requests
+    double ReadWriteInterference = 0;
+
+    // garbage collection: device-wide stalls with exponentially distributed intervals
+    SimTime GcIntervalMean = 0; // 0 disables GC
+    SimTime GcStallTime = 0;
+
+    // write buffer flush: device-wide stall after each N writes
+    size_t WriteBufferFlushWrites = 0; // 0 disables flushes
+    SimTime WriteBufferFlushTime = 0;
+};
+
+// ----------------------------
+// NVMeDevice
+
+class NVMeDevice final : public ItemBase {
+private:
+    enum class EResource {
+        Die,
+        Channel,
+    };
+
+    struct Operation {
+        std::optional<Event> _Event;
+        bool IsWrite = false;
+        size_t Die = 0;
+        size_t Step = 0; // writes: channel -> die, reads: die -> channel
+        SimTime FinishTs = 0;
+    };
+
+    struct Resource {
+        std::deque<size_t> WaitingOps;
+        std::optional<size_t> CurrentOp;
+        SimTime RemainingTime = 0;
+    };
+
+public:
+    NVMeDevice(const char* name, NVMeDeviceConfig config)
+        : Name(name)
+        , Config(std::move(config))
+        , Ops(Config.MaxInflight)
+        , Dies(Config.Channels * Config.DiesPerChannel)
+        , Channels(Config.Channels)
+        , ServiceTimeUs(Histogram::HistogramWithUsBuckets())
+        , Gen(std::make_unique<std::mt19937>(NewRandomSeed()))
+        , Dis(std::make_unique<std::uniform_real_distribution<>>(0, 100))
+    {
+        if (Config.MaxInflight == 0 || Config.Channels == 0 || Config.DiesPerChannel == 0) {
+            throw std::runtime_error("NVMe device must have non-zero inflight, channels and dies");
+        }
+        if (Config.ReadPercentiles.empty() && Config.WriteFraction < 1) {
+            throw std::runtime_error("Read percentiles must not be empty");
+        }
+        if (Config.WritePercentiles.empty() && Config.WriteFraction > 0) {
+            throw std::runtime_error("Write percentiles must not be empty");
+        }
+        for (size_t i = 1; i < Config.LatencyCurve.size(); ++i) {
+            if (Config.LatencyCurve[i].Inflight < Config.LatencyCurve[i - 1].Inflight) {
+                throw std::runtime_error("Latency curve must be sorted by inflight.");
+            }
+        }
+
+        for (size_t i = Ops.size(); i > 0; --i) {
+            FreeOps.push_back(i - 1);
+        }
+
+        ScheduleNextGc();
+    }
+
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime dt) override {
+        if (StallRemainingTime > 0) {
+            // nothing progresses during the stall
+            StallRemainingTime -= dt;
+            return;
+        }
+
+        if (Config.GcIntervalMean > 0 && Now() >= NextGcTs) {
+            StartStall(Config.GcStallTime);
+            ++GcCount;
+            ScheduleNextGc();
+            return;
+        }
+
+        // injected degradation slows down all internal resources
+        dt -= Fault.GetLostTime(dt);
+        if (dt == 0) {
+            return;
+        }
+
+        for (auto& channel: Channels) {
+            TickResource(channel, EResource::Channel, dt);
+        }
+
+        for (auto& die: Dies) {
+            TickResource(die, EResource::Die, dt);
+        }
+    }
+
+    bool IsReadyToPushEvent() const override {
+        return !FreeOps.empty();
+    }
+
+    void PushEvent(Event event) override {
+        if (!IsReadyToPushEvent()) {
+            throw std::runtime_error("NVMe device is full");
+        }
+
+        event.StartStage();
+
+        size_t opIndex = FreeOps.back();
+        FreeOps.pop_back();
+
+        auto& op = Ops[opIndex];
+        op._Event = event;
+        op.IsWrite = (*Dis)(*Gen) < Config.WriteFraction * 100;
+        op.Die = (size_t)((*Dis)(*Gen) / 100 * Dies.size()) % Dies.size();
+        op.Step = 0;
+
+        if (op.IsWrite) {
+            ++InflightWrites;
+        }
+
+        Enqueue(opIndex);
+    }
+
+    bool IsReadyToPopEvent() const override {
+        return !FinishedOps.empty() && !Fault.BlocksPop();
+    }
+
+    Event PopEvent() override {
+        if (!IsReadyToPopEvent()) {
+            throw std::runtime_error("No events ready");
+        }
+
+        size_t opIndex = FinishedOps.front();
+        FinishedOps.pop_front();
+
+        auto& op = Ops[opIndex];
+        auto event = *op._Event;
+        op._Event.reset();
+        ServiceTimeUs.AddTime(op.FinishTs - event.GetStageStartTime());
+        if (op.IsWrite) {
+            --InflightWrites;
+        }
+
+        FreeOps.push_back(opIndex);
+
+        return event;
+    }
+
+    size_t GetEventCount() const override {
+        return Ops.size() - FreeOps.size();
+    }
+
+    // from the submission till the completion, including the wait for dies and channels
+    const Histogram* GetServiceTimeUs() const override {
+        return &ServiceTimeUs;
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        writer.Write(Ops.size());
+        for (const auto& op: Ops) {
+            writer.Write(op._Event.has_value());
+            if (op._Event) {
+                op._Event->Save(writer);
+            }
+            writer.Write(op.IsWrite);
+            writer.Write(op.Die);
+            writer.Write(op.Step);
+            writer.Write(op.FinishTs);
+        }
+
+        SaveIndexes(writer, FreeOps);
+        SaveIndexes(writer, FinishedOps);
+        writer.Write(InflightWrites);
+
+        for (const auto* resources: {&Dies, &Channels}) {
+            for (const auto& resource: *resources) {
+                SaveIndexes(writer, resource.WaitingOps);
+                writer.Write(resource.CurrentOp.has_value());
+                writer.Write(resource.CurrentOp.value_or(0));
+                writer.Write(resource.RemainingTime);
+            }
+        }
+
+        writer.Write(StallRemainingTime);
+        writer.Write(NextGcTs);
+        writer.Write(WritesSinceFlush);
+        writer.Write(GcCount);
+        writer.Write(WriteBufferFlushCount);
+        ServiceTimeUs.Save(writer);
+
+        writer.WriteRandomEngine(*Gen);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        if (reader.Read<size_t>() != Ops.size()) {
+            throw std::runtime_error("NVMe device in snapshot has different inflight");
+        }
+        for (auto& op: Ops) {
+            op._Event.reset();
+            if (reader.Read<bool>()) {
+                op._Event = Event::Load(reader);
+            }
+            reader.Read(op.IsWrite);
+            reader.Read(op.Die);
+            reader.Read(op.Step);
+            reader.Read(op.FinishTs);
+            if (op.Die >= Dies.size()) {
+                throw std::runtime_error("NVMe device in snapshot has different number of dies");
+            }
+        }
+
+        LoadIndexes(reader, FreeOps);
+        LoadIndexes(reader, FinishedOps);
+        reader.Read(InflightWrites);
+
+        for (auto* resources: {&Dies, &Channels}) {
+            for (auto& resource: *resources) {
+                LoadIndexes(reader, resource.WaitingOps);
+                bool hasCurrentOp = reader.Read<bool>();
+                auto currentOp = reader.Read<size_t>();
+                resource.CurrentOp.reset();
+                if (hasCurrentOp) {
+                    resource.CurrentOp = currentOp;
+                }
+                reader.Read(resource.RemainingTime);
+            }
+        }
+
+        reader.Read(StallRemainingTime);
+        reader.Read(NextGcTs);
+        reader.Read(WritesSinceFlush);
+        reader.Read(GcCount);
+        reader.Read(WriteBufferFlushCount);
+        ServiceTimeUs.Load(reader);
+
+        reader.ReadRandomEngine(*Gen);
+    }
+
+    size_t GetInflight() const {
+        return Ops.size() - FreeOps.size();
+    }
+
+    bool IsStalled() const {
+        return StallRemainingTime > 0;
+    }
+
+public:
+    void Draw(arctic::Sprite toSprite) override {
+        auto width = toSprite.Width();
+        auto height = toSprite.Height();
+
+        auto minDimension = std::min(width, height);
+        auto yPos = height / 2 - minDimension / 2;
+
+        arctic::Vec2F bottomLeft(0, yPos);
+        arctic::Vec2F blockSize(minDimension, minDimension);
+
+        auto color = IsStalled() ? arctic::Rgba(200, 0, 0) : YDBColorWorker;
+        DrawBlock(toSprite, bottomLeft, blockSize, 10, color, 2, arctic::Rgba(0, 0, 0));
+
+        size_t busyDies = 0;
+        for (const auto& die: Dies) {
+            if (die.CurrentOp) {
+                ++busyDies;
+            }
+        }
+
+        char text[256];
+        snprintf(text, sizeof(text), "%s:\n%ld/%ld\nDies: %ld/%ld\nGC: %ld, WB: %ld",
+            Name, GetInflight(), Ops.size(), busyDies, Dies.size(), GcCount, WriteBufferFlushCount);
+        GetFont().Draw(toSprite, text, 5, yPos + minDimension / 4);
+    }
+
+private:
+    template <typename TContainer>
+    static void SaveIndexes(SnapshotWriter& writer, const TContainer& indexes) {
+        writer.Write(indexes.size());
+        for (size_t index: indexes) {
+            writer.Write(index);
+        }
+    }
+
+    template <typename TContainer>
+    void LoadIndexes(SnapshotReader& reader, TContainer& indexes) {
+        indexes.clear();
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto index = reader.Read<size_t>();
+            if (index >= Ops.size()) {
+                throw std::runtime_error("Bad operation index in snapshot");
+            }
+            indexes.push_back(index);
+        }
+    }
+
+    void Enqueue(size_t opIndex) {
+        auto& op = Ops[opIndex];
+
+        bool channelStep = op.IsWrite ? op.Step == 0 : op.Step == 1;
+        if (channelStep) {
+            Channels[op.Die / Config.DiesPerChannel].WaitingOps.push_back(opIndex);
+        } else {
+            Dies[op.Die].WaitingOps.push_back(opIndex);
+        }
+    }
+
+    void TickResource(Resource& resource, EResource type, SimTime dt) {
+        if (resource.CurrentOp) {
+            resource.RemainingTime -= dt;
+            if (resource.RemainingTime > 0) {
+                return;
+            }
+
+            size_t opIndex = *resource.CurrentOp;
+            resource.CurrentOp.reset();
+
+            auto& op = Ops[opIndex];
+            if (++op.Step == 2) {
+                op.FinishTs = Now();
+                FinishedOps.push_back(opIndex);
+                if (op.IsWrite) {
+                    OnWriteFinished();
+                }
+            } else {
+                Enqueue(opIndex);
+            }
+        }
+
+        if (resource.WaitingOps.empty()) {
+            return;
+        }
+
+        size_t opIndex = resource.WaitingOps.front();
+        resource.WaitingOps.pop_front();
+
+        resource.CurrentOp = opIndex;
+        if (type == EResource::Channel) {
+            resource.RemainingTime = Config.ChannelTransferTime;
+        } else {
+            resource.RemainingTime = GetDieServiceTime(Ops[opIndex]);
+        }
+    }
+
+    SimTime GetDieServiceTime(const Operation& op) {
+        double r = (*Dis)(*Gen);
+        double multiplier = GetLatencyMultiplier(GetInflight());
+
+        if (op.IsWrite) {
+            return (SimTime)(PercentileTimeProcessor::Sample(Config.WritePercentiles, r) * multiplier);
+        }
+
+        double writeShare = (double)InflightWrites / GetInflight();
+        multiplier *= 1 + Config.ReadWriteInterference * writeShare;
+
+        return (SimTime)(PercentileTimeProcessor::Sample(Config.ReadPercentiles, r) * multiplier);
+    }
+
+    double GetLatencyMultiplier(size_t inflight) const {
+        const auto& curve = Config.LatencyCurve;
+        if (curve.empty()) {
+            return 1;
+        }
+
+        if (inflight <= curve.front().Inflight) {
+            return curve.front().Multiplier;
+        }
+
+        for (size_t i = 1; i < curve.size(); ++i) {
+            if (inflight <= curve[i].Inflight) {
+                const auto& prev = curve[i - 1];
+                const auto& next = curve[i];
+                double ratio = (double)(inflight - prev.Inflight) / (next.Inflight - prev.Inflight);
+                return prev.Multiplier + (next.Multiplier - prev.Multiplier) * ratio;
+            }
+        }
+
+        return curve.back().Multiplier;
+    }
+
+    void OnWriteFinished() {
+        if (Config.WriteBufferFlushWrites == 0) {
+            return;
+        }
+
+        if (++WritesSinceFlush >= Config.WriteBufferFlushWrites) {
+            WritesSinceFlush = 0;
+            ++WriteBufferFlushCount;
+            StartStall(Config.WriteBufferFlushTime);
+        }
+    }
+
+    void StartStall(SimTime stallTime) {
+        StallRemainingTime = std::max(StallRemainingTime, stallTime);
+    }
+
+    void ScheduleNextGc() {
+        if (Config.GcIntervalMean <= 0) {
+            return;
+        }
+
+        std::exponential_distribution<> interval(1.0 / Config.GcIntervalMean);
+        NextGcTs = Now() + (SimTime)interval(*Gen);
+    }
+
+private:
+    const char* Name;
+    NVMeDeviceConfig Config;
+
+    std::vector<Operation> Ops;
+    std::vector<size_t> FreeOps;
+    std::deque<size_t> FinishedOps;
+    size_t InflightWrites = 0;
+
+    std::vector<Resource> Dies;
+    std::vector<Resource> Channels;
+
+    SimTime StallRemainingTime = 0;
+    SimTime NextGcTs = 0;
+    size_t WritesSinceFlush = 0;
+
+    size_t GcCount = 0;
+    size_t WriteBufferFlushCount = 0;
+    Histogram ServiceTimeUs;
+
+    std::unique_ptr<std::mt19937> Gen;
+    std::unique_ptr<std::uniform_real_distribution<>> Dis;
+};
+
+} // namespace queue_sim
@@ -0,0 +1,482 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+#include "engine/easy_drawing.h"
+#include "engine/easy_sprite.h"
+
+#include "common.h"
+#include "lockfree_queue.h"
+#include "simple_pipeline.h"
+
+// Conservative parallel simulation with time window synchronization.
+//
+// The model is split into partitions. Each partition has own clock, event counter
+// and stage chains, and is ticked by a single worker thread. Partitions communicate
+// only through remote links with non-zero latency: an event sent at time t arrives
+// at t + latency, i.e. not earlier than t + lookahead, where lookahead is the minimal
+// latency of all links. Thus within [T, T + lookahead) partitions don't depend on each
+// other and are simulated in parallel, workers synchronize only at window boundaries.
+
+namespace queue_sim {
+
+// ----------------------------
+// RemoteReceiver: entry point of a chain, events arrive from remote links.
+// Arrived events are kept ordered by the arrival time
+
+class RemoteReceiver final : public ItemBase {
+private:
+    struct Message {
+        Event _Event;
+        SimTime ArrivalTs;
+
+        // min-heap by arrival time, ties are broken by id to be deterministic
+        bool operator<(const Message& other) const {
+            if (ArrivalTs != other.ArrivalTs) {
+                return ArrivalTs > other.ArrivalTs;
+            }
+            return other._Event < _Event;
+        }
+    };
+
+public:
+    RemoteReceiver(const char* name)
+        : Name(name)
+    {
+    }
+
+    // might be called by any thread
+    void Post(const Event& event, SimTime arrivalTs) {
+        Mailbox.Push({event, arrivalTs});
+    }
+
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime) override {
+        while (auto message = Mailbox.TryPop()) {
+            Arrived.push(*message);
+        }
+    }
+
+    bool IsReadyToPushEvent() const override {
+        return false;
+    }
+
+    void PushEvent(Event) override {
+        throw std::runtime_error("Events can be only posted to remote receiver");
+    }
+
+    bool IsReadyToPopEvent() const override {
+        return !Arrived.empty() && Arrived.top().ArrivalTs <= Now();
+    }
+
+    Event PopEvent() override {
+        if (!IsReadyToPopEvent()) {
+            throw std::runtime_error("No events ready");
+        }
+
+        auto event = Arrived.top()._Event;
+        Arrived.pop();
+        ++ReceivedEvents;
+
+        event.StartStage();
+        return event;
+    }
+
+    // events already posted, but not delivered yet
+    size_t GetEventCount() const override {
+        return Arrived.size();
+    }
+
+    // mailbox is empty at window boundaries, when the state can be saved
+    void SaveState(SnapshotWriter& writer) const override {
+        auto arrived = Arrived;
+        writer.Write(arrived.size());
+        while (!arrived.empty()) {
+            arrived.top()._Event.Save(writer);
+            writer.Write(arrived.top().ArrivalTs);
+            arrived.pop();
+        }
+        writer.Write(ReceivedEvents);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        Arrived = {};
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto event = Event::Load(reader);
+            Arrived.push({event, reader.Read<SimTime>()});
+        }
+        reader.Read(ReceivedEvents);
+    }
+
+public:
+    void Draw(arctic::Sprite toSprite) override {
+        char text[128];
+        snprintf(text, sizeof(text), "%s: %ld\nReceived: %s",
+            Name, Arrived.size(), NumToStrWithSuffix(ReceivedEvents).c_str());
+        GetFont().Draw(toSprite, text, 5, toSprite.Height() / 2);
+    }
+
+private:
+    const char* Name;
+    MpscMailbox<Message> Mailbox;
+    std::priority_queue<Message> Arrived;
+    size_t ReceivedEvents = 0;
+};
+
+// ----------------------------
+// RemoteSender: exit point of a chain, sends events over the links.
+// Links are indexed either by the destination or by the source of the event
+
+enum class ERemoteRoute {
+    ByDst, // requests
+    BySrc, // responses
+};
+
+class RemoteSender final : public ItemBase {
+private:
+    struct Link {
+        RemoteReceiver* Receiver;
+        SimTime Latency;
+    };
+
+public:
+    RemoteSender(const char* name, ERemoteRoute route)
+        : Name(name)
+        , Route(route)
+    {
+    }
+
+    void AddLink(RemoteReceiver* receiver, SimTime latency) {
+        if (latency <= 0) {
+            throw std::runtime_error("Remote link must have positive latency");
+        }
+        Links.push_back({receiver, latency});
+    }
+
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime) override {
+        /* do nothing */
+    }
+
+    bool IsReadyToPushEvent() const override {
+        return true;
+    }
+
+    void PushEvent(Event event) override {
+        size_t linkIndex = Route == ERemoteRoute::ByDst ? event.GetDst() : event.GetSrc();
+        if (linkIndex >= Links.size()) {
+            throw std::runtime_error("No remote link for the event");
+        }
+
+        auto& link = Links[linkIndex];
+        link.Receiver->Post(event, Now() + link.Latency);
+        ++SentEvents;
+    }
+
+    bool IsReadyToPopEvent() const override {
+        return false;
+    }
+
+    Event PopEvent() override {
+        throw std::runtime_error("Remote sender has no events to pop");
+    }
+
+    // events are handed over to the remote receiver at once
+    size_t GetEventCount() const override {
+        return 0;
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        writer.Write(SentEvents);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        reader.Read(SentEvents);
+    }
+
+public:
+    void Draw(arctic::Sprite toSprite) override {
+        char text[128];
+        snprintf(text, sizeof(text), "%s\nSent: %s", Name, NumToStrWithSuffix(SentEvents).c_str());
+        GetFont().Draw(toSprite, text, 5, toSprite.Height() / 2);
+    }
+
+private:
+    const char* Name;
+    ERemoteRoute Route;
+    std::vector<Link> Links;
+    size_t SentEvents = 0;
+};
+
+// ----------------------------
+// ClosedLoopClient: keeps N requests in flight, each request goes to a random destination.
+// Pops new requests and takes back the finished ones
+
+class ClosedLoopClient final : public ItemBase {
+public:
+    ClosedLoopClient(const char* name, size_t clientId, size_t inflight, size_t destinationCount)
+        : Name(name)
+        , ClientId(clientId)
+        , MaxInflight(inflight)
+        , EventDurationsUs(Histogram::HistogramWithUsBuckets())
+        , Gen(std::make_unique<std::mt19937>(NewRandomSeed()))
+        , Dis(std::make_unique<std::uniform_int_distribution<size_t>>(0, destinationCount - 1))
+    {
+        if (destinationCount == 0) {
+            throw std::runtime_error("Client must have destinations");
+        }
+    }
+
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime) override {
+        /* do nothing */
+    }
+
+    bool IsReadyToPushEvent() const override {
+        return true;
+    }
+
+    void PushEvent(Event event) override {
+        if (Inflight == 0) {
+            throw std::runtime_error("Client got unexpected event");
+        }
+
+        --Inflight;
+        ++FinishedEvents;
+        EventDurationsUs.AddTime(event.GetDuration());
+    }
+
+    bool IsReadyToPopEvent() const override {
+        return Inflight < MaxInflight;
+    }
+
+    Event PopEvent() override {
+        if (!IsReadyToPopEvent()) {
+            throw std::runtime_error("No events ready");
+        }
+
+        ++Inflight;
+        return Event::NewEvent(ClientId, (*Dis)(*Gen));
+    }
+
+    // the client is the source and the sink of events, they are never in it
+    size_t GetEventCount() const override {
+        return 0;
+    }
+
+    size_t GetFinishedEvents() const {
+        return FinishedEvents;
+    }
+
+    const Histogram& GetEventDurationsUs() const {
+        return EventDurationsUs;
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        writer.Write(Inflight);
+        writer.Write(FinishedEvents);
+        EventDurationsUs.Save(writer);
+        writer.WriteRandomEngine(*Gen);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        reader.Read(Inflight);
+        reader.Read(FinishedEvents);
+        EventDurationsUs.Load(reader);
+        reader.ReadRandomEngine(*Gen);
+    }
+
+public:
+    void Draw(arctic::Sprite toSprite) override {
+        char text[128];
+        snprintf(text, sizeof(text), "%s: %ld/%ld\np90: %d us",
+            Name, Inflight, MaxInflight, EventDurationsUs.GetPercentile(90));
+        GetFont().Draw(toSprite, text, 5, toSprite.Height() / 2);
+    }
+
+private:
+    const char* Name;
+    size_t ClientId;
+    size_t MaxInflight;
+    size_t Inflight = 0;
+
+    size_t FinishedEvents = 0;
+    Histogram EventDurationsUs;
+
+    std::unique_ptr<std::mt19937> Gen;
+    std::unique_ptr<std::uniform_int_distribution<size_t>> Dis;
+};
+
+// ----------------------------
+// Partition: part of the model ticked by a single thread
+
+class Partition {
+public:
+    // ids of events created by different partitions must not intersect
+    static constexpr size_t EventIdsPerPartition = size_t(1) << 40;
+
+    Partition(size_t index)
+        : EventCounter(index * EventIdsPerPartition)
+    {
+    }
+
+    StageChain& AddChain() {
+        Chains.emplace_back(std::make_unique<StageChain>());
+        return *Chains.back();
+    }
+
+    SimTime GetTime() const {
+        return Time;
+    }
+
+    // clock and event counter are per thread, so they are switched to the partition's ones
+    void Advance(SimTime until, SimTime dt) {
+        SetTime(Time);
+        Event::SetEventCounter(EventCounter);
+
+        while (Now() < until) {
+            AdvanceTime(dt);
+            for (auto& chain: Chains) {
+                chain->Tick(dt);
+            }
+        }
+
+        Time = Now();
+        EventCounter = Event::GetEventCounter();
+    }
+
+private:
+    SimTime Time = 0;
+    size_t EventCounter;
+    std::vector<std::unique_ptr<StageChain>> Chains;
+};
+
+// ----------------------------
+// SpinBarrier: windows are short, so workers spin instead of sleeping
+
+class SpinBarrier {
+public:
+    SpinBarrier(size_t count)
+        : Count(count)
+    {
+    }
+
+    void Wait() {
+        auto generation = Generation.load(std::memory_order_acquire);
+        if (Waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == Count) {
+            Waiting.store(0, std::memory_order_relaxed);
+            Generation.fetch_add(1, std::memory_order_release);
+            return;
+        }
+
+        SpinWait spinWait;
+        while (Generation.load(std::memory_order_acquire) == generation) {
+            spinWait.Wait();
+        }
+    }
+
+private:
+    const size_t Count;
+    alignas(CacheLineSize) std::atomic<size_t> Waiting{0};
+    alignas(CacheLineSize) std::atomic<size_t> Generation{0};
+};
+
+// ----------------------------
+// ParallelSimulation
+
+class ParallelSimulation {
+public:
+    Partition& AddPartition() {
+        Partitions.emplace_back(std::make_unique<Partition>(Partitions.size()));
+        return *Partitions.back();
+    }
+
+    void Connect(RemoteSender* sender, RemoteReceiver* receiver, SimTime latency) {
+        sender->AddLink(receiver, latency);
+        Lookahead = Lookahead == 0 ? latency : std::min(Lookahead, latency);
+    }
+
+    SimTime GetLookahead() const {
+        return Lookahead;
+    }
+
+    size_t GetWindowCount() const {
+        return WindowCount;
+    }
+
+    // simulates the next duration seconds of the model
+    void Run(SimTime duration, SimTime dt, size_t threadCount) {
+        if (Partitions.empty()) {
+            return;
+        }
+
+        if (Lookahead < dt) {
+            throw std::runtime_error("Lookahead (minimal link latency) must not be less than the tick");
+        }
+
+        // otherwise the last tick of a window ends after the window, i.e. before the remote
+        // events for that time are delivered
+        if (Lookahead % dt != 0 || duration % dt != 0) {
+            throw std::runtime_error("Lookahead (minimal link latency) and duration must be multiples of the tick");
+        }
+
+        threadCount = std::max<size_t>(1, std::min(threadCount, Partitions.size()));
+
+        SimTime startTime = Partitions.front()->GetTime();
+        SimTime finishTime = startTime + duration;
+
+        SpinBarrier barrier(threadCount);
+        auto worker = [&](size_t workerIndex) {
+            SimTime windowStart = startTime;
+            while (windowStart < finishTime) {
+                SimTime windowEnd = std::min(windowStart + Lookahead, finishTime);
+                for (size_t i = workerIndex; i < Partitions.size(); i += threadCount) {
+                    Partitions[i]->Advance(windowEnd, dt);
+                }
+
+                // all events sent within the window are posted before anyone goes further
+                barrier.Wait();
+                windowStart = windowEnd;
+
+                if (workerIndex == 0) {
+                    ++WindowCount;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < threadCount; ++i) {
+            threads.emplace_back(worker, i);
+        }
+
+        worker(0);
+
+        for (auto& thread: threads) {
+            thread.join();
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<Partition>> Partitions;
+    SimTime Lookahead = 0;
+    size_t WindowCount = 0;
+};
+
+} // namespace queue_sim
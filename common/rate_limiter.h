@@ -0,0 +1,719 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "engine/easy.h"
+#include "engine/easy_drawing.h"
+#include "engine/easy_sprite.h"
+
+#include "common.h"
+
+// Admission control: events wait in the rate limiter, till the algorithm admits them.
+// Tenants (event sources) wait in separate queues and are admitted round-robin, so
+// a throttled tenant doesn't block the others. Concurrency limiters need to know, when
+// admitted events finish: the owner of the pipeline calls RateLimiter::OnEventFinished
+
+namespace queue_sim {
+
+// ----------------------------
+// RateLimitAlgorithm
+
+class RateLimitAlgorithm {
+public:
+    virtual ~RateLimitAlgorithm() = default;
+
+    virtual void Tick(SimTime /* dt */) {
+    }
+
+    virtual bool CanAdmit(size_t tenantId) const = 0;
+    virtual void OnAdmitted(size_t tenantId) = 0;
+
+    // the admitted event has left the pipeline, latency is since the admission
+    virtual void OnCompleted(size_t /* tenantId */, SimTime /* latency */) {
+    }
+
+    // the admitted event has been cancelled, e.g. timed out
+    virtual void OnDropped(size_t /* tenantId */) {
+    }
+
+    // short, for the stage's picture
+    virtual std::string GetText() const = 0;
+
+    // state only, as for the stages
+    virtual void SaveState(SnapshotWriter& writer) const = 0;
+    virtual void LoadState(SnapshotReader& reader) = 0;
+};
+
+// ----------------------------
+// TokenBucketLimit: a bucket per tenant, each admitted event takes a token
+
+struct TokenBucketConfig {
+    double RateRps = 0; // 0 means unlimited
+    double Burst = 1;   // bucket size, the bucket is full at start
+};
+
+class TokenBucketLimit final : public RateLimitAlgorithm {
+private:
+    struct Bucket {
+        TokenBucketConfig Config;
+        double Tokens = 0;
+    };
+
+public:
+    // tenants without own config use the default one
+    TokenBucketLimit(TokenBucketConfig defaultConfig = {})
+        : DefaultConfig(defaultConfig)
+    {
+        if (DefaultConfig.Burst < 1) {
+            throw std::runtime_error("Token bucket must have room for at least 1 token");
+        }
+    }
+
+    void SetTenantLimit(size_t tenantId, TokenBucketConfig config) {
+        if (config.Burst < 1) {
+            throw std::runtime_error("Token bucket must have room for at least 1 token");
+        }
+        Buckets[tenantId] = {config, config.Burst};
+    }
+
+    void Tick(SimTime dt) override {
+        for (auto& [id, bucket]: Buckets) {
+            bucket.Tokens = std::min(bucket.Config.Burst, bucket.Tokens + bucket.Config.RateRps * ToSeconds(dt));
+        }
+    }
+
+    bool CanAdmit(size_t tenantId) const override {
+        auto it = Buckets.find(tenantId);
+        if (it == Buckets.end()) {
+            return DefaultConfig.RateRps == 0 || DefaultConfig.Burst >= 1;
+        }
+        const auto& bucket = it->second;
+        return bucket.Config.RateRps == 0 || bucket.Tokens >= 1;
+    }
+
+    void OnAdmitted(size_t tenantId) override {
+        auto it = Buckets.find(tenantId);
+        if (it == Buckets.end()) {
+            if (DefaultConfig.RateRps == 0) {
+                return;
+            }
+            it = Buckets.emplace(tenantId, Bucket{DefaultConfig, DefaultConfig.Burst}).first;
+        }
+        if (it->second.Config.RateRps != 0) {
+            it->second.Tokens -= 1;
+        }
+    }
+
+    std::string GetText() const override {
+        return "tenants: " + std::to_string(Buckets.size());
+    }
+
+    // buckets created for the tenants with the default config are the state too
+    void SaveState(SnapshotWriter& writer) const override {
+        writer.Write(Buckets.size());
+        for (const auto& [id, bucket]: Buckets) {
+            writer.Write(id);
+            writer.Write(bucket.Tokens);
+        }
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto id = reader.Read<size_t>();
+            auto it = Buckets.find(id);
+            if (it == Buckets.end()) {
+                it = Buckets.emplace(id, Bucket{DefaultConfig, DefaultConfig.Burst}).first;
+            }
+            reader.Read(it->second.Tokens);
+        }
+    }
+
+private:
+    TokenBucketConfig DefaultConfig;
+    std::map<size_t, Bucket> Buckets;
+};
+
+// ----------------------------
+// ConcurrencyLimit: the base of the adaptive limiters, admits events while the number of
+// admitted unfinished events is below the limit. The limit is shared by the active tenants
+// in proportion to their weights: a tenant above its share is admitted only while each
+// other active tenant below its share keeps a free slot, so a quiet tenant doesn't wait
+// for a noisy one's events to finish. The limit itself adapts to the latency of all the
+// tenants, and the stages after the limiter are still FIFO
+
+struct ConcurrencyLimitConfig {
+    double InitialLimit = 32;
+    double MinLimit = 1;
+    double MaxLimit = 1024;
+
+    // a tenant without events in flight and admissions for this long doesn't get a share
+    SimTime TenantIdleTimeout = 1 * Msec;
+};
+
+class ConcurrencyLimit : public RateLimitAlgorithm {
+private:
+    struct TenantState {
+        double Weight = 1;
+        size_t InFlight = 0;
+        SimTime LastAdmitTs = std::numeric_limits<SimTime>::min();
+    };
+
+public:
+    ConcurrencyLimit(ConcurrencyLimitConfig config)
+        : Config(config)
+        , Limit(config.InitialLimit)
+    {
+        if (Config.MinLimit < 1 || Config.MinLimit > Config.MaxLimit) {
+            throw std::runtime_error("Concurrency limit must be at least 1 and min must not exceed max");
+        }
+    }
+
+    // tenants have weight 1 by default
+    void SetTenantWeight(size_t tenantId, double weight) {
+        if (weight <= 0) {
+            throw std::runtime_error("Tenant weight must be positive");
+        }
+        Tenants[tenantId].Weight = weight;
+    }
+
+    bool CanAdmit(size_t tenantId) const override {
+        if (InFlight >= (size_t)Limit) {
+            return false;
+        }
+
+        auto now = Now();
+        auto it = Tenants.find(tenantId);
+        double weight = it != Tenants.end() ? it->second.Weight : 1;
+        size_t inFlight = it != Tenants.end() ? it->second.InFlight : 0;
+
+        double totalWeight = weight;
+        for (const auto& [id, tenant]: Tenants) {
+            if (id != tenantId && IsActive(tenant, now)) {
+                totalWeight += tenant.Weight;
+            }
+        }
+
+        if (inFlight < Limit * weight / totalWeight) {
+            return true;
+        }
+
+        // above the share: a slot is left for each other active tenant below its share
+        size_t reserved = 0;
+        for (const auto& [id, tenant]: Tenants) {
+            if (id != tenantId && IsActive(tenant, now) && tenant.InFlight < Limit * tenant.Weight / totalWeight) {
+                ++reserved;
+            }
+        }
+        return InFlight + reserved < (size_t)Limit;
+    }
+
+    void OnAdmitted(size_t tenantId) override {
+        auto& tenant = Tenants[tenantId];
+        ++tenant.InFlight;
+        tenant.LastAdmitTs = Now();
+        ++InFlight;
+    }
+
+    void OnCompleted(size_t tenantId, SimTime latency) override {
+        --Tenants[tenantId].InFlight;
+        --InFlight;
+        UpdateLimit(latency);
+    }
+
+    void OnDropped(size_t tenantId) override {
+        --Tenants[tenantId].InFlight;
+        --InFlight;
+        OnDrop();
+    }
+
+    double GetLimit() const {
+        return Limit;
+    }
+
+    std::string GetText() const override {
+        char text[64];
+        snprintf(text, sizeof(text), "limit: %.1f\ninflight: %ld", Limit, InFlight);
+        return text;
+    }
+
+    // weights are the config, they are set by SetTenantWeight
+    void SaveState(SnapshotWriter& writer) const override {
+        writer.Write(Limit);
+        writer.Write(InFlight);
+
+        writer.Write(Tenants.size());
+        for (const auto& [id, tenant]: Tenants) {
+            writer.Write(id);
+            writer.Write(tenant.InFlight);
+            writer.Write(tenant.LastAdmitTs);
+        }
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        reader.Read(Limit);
+        reader.Read(InFlight);
+
+        for (auto& [id, tenant]: Tenants) {
+            tenant.InFlight = 0;
+            tenant.LastAdmitTs = std::numeric_limits<SimTime>::min();
+        }
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto& tenant = Tenants[reader.Read<size_t>()];
+            reader.Read(tenant.InFlight);
+            reader.Read(tenant.LastAdmitTs);
+        }
+    }
+
+protected:
+    virtual void UpdateLimit(SimTime latency) = 0;
+    virtual void OnDrop() = 0;
+
+    void SetLimit(double limit) {
+        Limit = std::clamp(limit, Config.MinLimit, Config.MaxLimit);
+    }
+
+private:
+    bool IsActive(const TenantState& tenant, SimTime now) const {
+        return tenant.InFlight > 0 || now - tenant.LastAdmitTs < Config.TenantIdleTimeout;
+    }
+
+protected:
+    ConcurrencyLimitConfig Config;
+    double Limit;
+    size_t InFlight = 0;
+
+    std::map<size_t, TenantState> Tenants;
+};
+
+// ----------------------------
+// AimdLimit: additive increase while the latency is below the target, multiplicative
+// decrease otherwise and on drops
+
+struct AimdConfig {
+    SimTime LatencyTarget = 1 * Msec;
+    double Increase = 1;     // per limit completions, i.e. roughly per round trip
+    double Backoff = 0.9;
+};
+
+class AimdLimit final : public ConcurrencyLimit {
+public:
+    AimdLimit(ConcurrencyLimitConfig limitConfig, AimdConfig config)
+        : ConcurrencyLimit(limitConfig)
+        , Aimd(config)
+    {
+        if (Aimd.Backoff <= 0 || Aimd.Backoff >= 1) {
+            throw std::runtime_error("AIMD backoff must be between 0 and 1");
+        }
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        ConcurrencyLimit::SaveState(writer);
+        writer.Write(LastDecreaseTs);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        ConcurrencyLimit::LoadState(reader);
+        reader.Read(LastDecreaseTs);
+    }
+
+private:
+    void UpdateLimit(SimTime latency) override {
+        if (latency > Aimd.LatencyTarget) {
+            Decrease();
+        } else {
+            SetLimit(Limit + Aimd.Increase / Limit);
+        }
+    }
+
+    void OnDrop() override {
+        Decrease();
+    }
+
+    // once per round trip, otherwise all the events of the same burst would back off
+    void Decrease() {
+        auto now = Now();
+        if (now - LastDecreaseTs < Aimd.LatencyTarget) {
+            return;
+        }
+        LastDecreaseTs = now;
+        SetLimit(Limit * Aimd.Backoff);
+    }
+
+private:
+    AimdConfig Aimd;
+    SimTime LastDecreaseTs = -Sec;
+};
+
+// ----------------------------
+// VegasLimit: estimates the queue from the latency over the minimal observed one,
+// keeps it between Alpha and Beta events
+
+struct VegasConfig {
+    double Alpha = 3;
+    double Beta = 6;
+};
+
+class VegasLimit final : public ConcurrencyLimit {
+public:
+    VegasLimit(ConcurrencyLimitConfig limitConfig, VegasConfig config)
+        : ConcurrencyLimit(limitConfig)
+        , Vegas(config)
+    {
+        if (Vegas.Alpha >= Vegas.Beta) {
+            throw std::runtime_error("Vegas alpha must be less than beta");
+        }
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        ConcurrencyLimit::SaveState(writer);
+        writer.Write(MinLatency);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        ConcurrencyLimit::LoadState(reader);
+        reader.Read(MinLatency);
+    }
+
+private:
+    void UpdateLimit(SimTime latency) override {
+        if (latency <= 0) {
+            return;
+        }
+        if (MinLatency == 0 || latency < MinLatency) {
+            MinLatency = latency;
+        }
+
+        double queue = Limit * (1 - (double)MinLatency / latency);
+        if (queue < Vegas.Alpha) {
+            SetLimit(Limit + 1 / Limit);
+        } else if (queue > Vegas.Beta) {
+            SetLimit(Limit - 1 / Limit);
+        }
+    }
+
+    void OnDrop() override {
+        SetLimit(Limit / 2);
+    }
+
+private:
+    VegasConfig Vegas;
+    SimTime MinLatency = 0;
+};
+
+// ----------------------------
+// RateLimiter: the stage
+
+class RateLimiter final : public ItemBase {
+private:
+    struct AdmittedEvent {
+        size_t TenantId = 0;
+        SimTime AdmitTs = 0;
+    };
+
+public:
+    RateLimiter(const char* name, std::unique_ptr<RateLimitAlgorithm> algorithm)
+        : Name(name)
+        , Algorithm(std::move(algorithm))
+        , ThrottlingDelayUs(Histogram::HistogramWithUsBuckets())
+    {
+    }
+
+    const char* GetName() const override {
+        return Name;
+    }
+
+    RateLimitAlgorithm& GetAlgorithm() {
+        return *Algorithm;
+    }
+
+    void Tick(SimTime dt) override {
+        if (Fault.Stalled) {
+            return;
+        }
+        Algorithm->Tick(dt);
+        Admit();
+    }
+
+    bool IsReadyToPushEvent() const override {
+        // waiting events are unlimited, as in the queue
+        return true;
+    }
+
+    void PushEvent(Event event) override {
+        event.StartStage();
+        Waiting[event.GetSrc()].push_back(event);
+        ++WaitingCount;
+
+        // events go through at once, when the limit allows
+        if (!Fault.Stalled) {
+            Admit();
+        }
+    }
+
+    bool IsReadyToPopEvent() const override {
+        return !Admitted.empty() && !Fault.BlocksPop();
+    }
+
+    Event PopEvent() override {
+        if (!IsReadyToPopEvent()) {
+            throw std::runtime_error("No events ready");
+        }
+
+        auto event = Admitted.front();
+        Admitted.pop_front();
+        return event;
+    }
+
+    bool CancelEvent(size_t id) override {
+        auto sameId = [id](const Event& event) { return event.GetId() == id; };
+
+        for (auto& [tenantId, events]: Waiting) {
+            auto it = std::find_if(events.begin(), events.end(), sameId);
+            if (it != events.end()) {
+                events.erase(it);
+                --WaitingCount;
+                return true;
+            }
+        }
+
+        auto admittedIt = std::find_if(Admitted.begin(), Admitted.end(), sameId);
+        bool wasAdmitted = admittedIt != Admitted.end();
+        if (wasAdmitted) {
+            Admitted.erase(admittedIt);
+        }
+
+        // admitted events are in flight till they leave the pipeline
+        auto it = InFlight.find(id);
+        if (it != InFlight.end()) {
+            Algorithm->OnDropped(it->second.TenantId);
+            InFlight.erase(it);
+        }
+
+        return wasAdmitted;
+    }
+
+    // called, when the event leaves the pipeline
+    void OnEventFinished(const Event& event) {
+        auto it = InFlight.find(event.GetId());
+        if (it == InFlight.end()) {
+            return;
+        }
+        Algorithm->OnCompleted(it->second.TenantId, Now() - it->second.AdmitTs);
+        InFlight.erase(it);
+    }
+
+    size_t GetEventCount() const override {
+        return WaitingCount + Admitted.size();
+    }
+
+    // of the throttled events only, events admitted at once are counted by GetThrottledShare
+    const Histogram* GetThrottlingDelayUs() const override {
+        return &ThrottlingDelayUs;
+    }
+
+    // null, when the tenant has not been throttled
+    const Histogram* GetTenantThrottlingDelayUs(size_t tenantId) const {
+        auto it = TenantThrottlingDelayUs.find(tenantId);
+        return it != TenantThrottlingDelayUs.end() ? &it->second : nullptr;
+    }
+
+    // share of the admitted events, which have waited for the admission
+    double GetThrottledShare() const {
+        return AdmittedEvents ? (double)ThrottledEvents / AdmittedEvents : 0;
+    }
+
+    double GetTenantThrottledShare(size_t tenantId) const {
+        auto admittedIt = TenantAdmittedEvents.find(tenantId);
+        auto* delayUs = GetTenantThrottlingDelayUs(tenantId);
+        if (admittedIt == TenantAdmittedEvents.end() || !delayUs) {
+            return 0;
+        }
+        return (double)delayUs->GetCount() / admittedIt->second;
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        writer.Write(Waiting.size());
+        for (const auto& [tenantId, events]: Waiting) {
+            writer.Write(tenantId);
+            writer.Write(events.size());
+            for (const auto& event: events) {
+                event.Save(writer);
+            }
+        }
+        writer.Write(NextTenantId);
+
+        writer.Write(Admitted.size());
+        for (const auto& event: Admitted) {
+            event.Save(writer);
+        }
+
+        writer.Write(InFlight.size());
+        for (const auto& [id, admitted]: InFlight) {
+            writer.Write(id);
+            writer.Write(admitted.TenantId);
+            writer.Write(admitted.AdmitTs);
+        }
+
+        Algorithm->SaveState(writer);
+
+        ThrottlingDelayUs.Save(writer);
+        writer.Write(TenantThrottlingDelayUs.size());
+        for (const auto& [tenantId, histogram]: TenantThrottlingDelayUs) {
+            writer.Write(tenantId);
+            histogram.Save(writer);
+        }
+        writer.Write(AdmittedEvents);
+        writer.Write(ThrottledEvents);
+        writer.Write(TenantAdmittedEvents.size());
+        for (const auto& [tenantId, admitted]: TenantAdmittedEvents) {
+            writer.Write(tenantId);
+            writer.Write(admitted);
+        }
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        Waiting.clear();
+        WaitingCount = 0;
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto& events = Waiting[reader.Read<size_t>()];
+            auto eventCount = reader.Read<size_t>();
+            for (size_t j = 0; j < eventCount; ++j) {
+                events.push_back(Event::Load(reader));
+            }
+            WaitingCount += eventCount;
+        }
+        reader.Read(NextTenantId);
+
+        Admitted.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            Admitted.push_back(Event::Load(reader));
+        }
+
+        InFlight.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto id = reader.Read<size_t>();
+            AdmittedEvent admitted;
+            reader.Read(admitted.TenantId);
+            reader.Read(admitted.AdmitTs);
+            InFlight.emplace(id, admitted);
+        }
+
+        Algorithm->LoadState(reader);
+
+        ThrottlingDelayUs.Load(reader);
+        TenantThrottlingDelayUs.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto tenantId = reader.Read<size_t>();
+            auto& histogram = TenantThrottlingDelayUs.emplace(tenantId, Histogram::HistogramWithUsBuckets()).first->second;
+            histogram.Load(reader);
+        }
+        reader.Read(AdmittedEvents);
+        reader.Read(ThrottledEvents);
+        TenantAdmittedEvents.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto tenantId = reader.Read<size_t>();
+            reader.Read(TenantAdmittedEvents[tenantId]);
+        }
+    }
+
+public:
+    void Draw(arctic::Sprite toSprite) override {
+        char text[256];
+        snprintf(text, sizeof(text), "%s: %ld\nthrottled p90: %d us\n%s",
+            Name, WaitingCount, ThrottlingDelayUs.GetPercentile(90), Algorithm->GetText().c_str());
+        GetFont().Draw(toSprite, text, 5, toSprite.Height() / 2);
+    }
+
+private:
+    // round-robin over the tenants with waiting events, till none can be admitted
+    void Admit() {
+        while (WaitingCount != 0) {
+            bool admitted = false;
+
+            auto it = Waiting.lower_bound(NextTenantId);
+            for (size_t i = 0; i < Waiting.size(); ++i, ++it) {
+                if (it == Waiting.end()) {
+                    it = Waiting.begin();
+                }
+
+                auto tenantId = it->first;
+                auto& events = it->second;
+                if (events.empty() || !Algorithm->CanAdmit(tenantId)) {
+                    continue;
+                }
+
+                AdmitEvent(tenantId, events.front());
+                events.pop_front();
+                --WaitingCount;
+                NextTenantId = tenantId + 1;
+                admitted = true;
+            }
+
+            if (!admitted) {
+                break;
+            }
+        }
+    }
+
+    void AdmitEvent(size_t tenantId, Event event) {
+        auto now = Now();
+        auto delay = event.GetStageDuration();
+
+        Algorithm->OnAdmitted(tenantId);
+        InFlight.emplace(event.GetId(), AdmittedEvent{tenantId, now});
+
+        ++AdmittedEvents;
+        ++TenantAdmittedEvents[tenantId];
+        Admitted.push_back(event);
+
+        // events admitted at once would hide the delays of the throttled ones in the lowest bucket
+        if (delay == 0) {
+            return;
+        }
+
+        ++ThrottledEvents;
+        ThrottlingDelayUs.AddTime(delay);
+
+        auto it = TenantThrottlingDelayUs.find(tenantId);
+        if (it == TenantThrottlingDelayUs.end()) {
+            it = TenantThrottlingDelayUs.emplace(tenantId, Histogram::HistogramWithUsBuckets()).first;
+        }
+        it->second.AddTime(delay);
+    }
+
+private:
+    const char* Name;
+    std::unique_ptr<RateLimitAlgorithm> Algorithm;
+
+    // by tenant
+    std::map<size_t, std::deque<Event>> Waiting;
+    size_t WaitingCount = 0;
+    size_t NextTenantId = 0;
+
+    std::deque<Event> Admitted;
+
+    // admitted events, which haven't left the pipeline yet
+    std::map<size_t, AdmittedEvent> InFlight;
+
+    // of the throttled events
+    Histogram ThrottlingDelayUs;
+    std::map<size_t, Histogram> TenantThrottlingDelayUs;
+
+    size_t AdmittedEvents = 0;
+    size_t ThrottledEvents = 0;
+    std::map<size_t, size_t> TenantAdmittedEvents;
+};
+
+} // namespace queue_sim
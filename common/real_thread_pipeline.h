@@ -0,0 +1,443 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "lockfree_queue.h"
+#include "thread_handoff.h"
+
+// Runs the same stage topology as ClosedPipeLine, but with real OS threads.
+// Used to validate the simulation: it has the same Add* interface, so
+// the same model setup function can be used for both.
+//
+// Mapping of stages:
+//  * Queue and ThreadHandoff: lock-free queue between the neighbour stages,
+//    the handoff cost is real here;
+//  * FixedTimeExecutor: N threads burning CPU for the execution time;
+//  * PercentileTimeExecutor: device emulation, a single thread which holds up to N
+//    events and releases them after the sampled time (device time doesn't burn host CPU);
+//  * FlushController: a single thread reordering events.
+// Between two stages without a queue there is an implicit queue as well.
+
+namespace queue_sim {
+
+// ----------------------------
+// BusyWork: burns CPU, stands in for the service time
+
+class BusyWork {
+public:
+    static void Calibrate() {
+        constexpr size_t iterations = 1 << 24;
+        double bestTime = 0;
+        for (size_t i = 0; i < 5; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            Burn(iterations);
+            std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+            if (i == 0 || duration.count() < bestTime) {
+                bestTime = duration.count();
+            }
+        }
+
+        IterationsPerSecond = iterations / bestTime;
+    }
+
+    static void Run(SimTime time) {
+        Burn((size_t)(ToSeconds(time) * IterationsPerSecond));
+    }
+
+private:
+    static void Burn(size_t iterations) {
+        size_t value = Sink.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < iterations; ++i) {
+            value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+        Sink.store(value, std::memory_order_relaxed);
+    }
+
+private:
+    static inline double IterationsPerSecond = 0;
+    static inline std::atomic<size_t> Sink{0};
+};
+
+// ----------------------------
+// RealThreadPipeLine
+
+class RealThreadPipeLine {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct RealEvent {
+        size_t Id = 0;
+        Clock::time_point StartTime;
+        Clock::time_point StageStarted;
+    };
+
+    enum class EStageKind {
+        Queue,
+        Workers,
+        Device,
+        Flush,
+    };
+
+    struct StageConfig {
+        EStageKind Kind;
+        const char* Name;
+        size_t InitialEvents = 0;
+        size_t ProcessorCount = 1;
+        SimTime ExecutionTime = 0;
+        PercentileTimeProcessor::Percentiles Percentiles;
+    };
+
+    class Channel {
+    public:
+        Channel(std::string name, size_t producers, size_t consumers, size_t capacity)
+            : Name(std::move(name))
+        {
+            if (producers == 1 && consumers == 1) {
+                Spsc = std::make_unique<SpscQueue<RealEvent>>(capacity);
+            } else {
+                Mpmc = std::make_unique<MpmcQueue<RealEvent>>(capacity);
+            }
+        }
+
+        bool TryPush(const RealEvent& event) {
+            return Spsc ? Spsc->TryPush(event) : Mpmc->TryPush(event);
+        }
+
+        bool TryPop(RealEvent& event) {
+            return Spsc ? Spsc->TryPop(event) : Mpmc->TryPop(event);
+        }
+
+        const std::string& GetName() const {
+            return Name;
+        }
+
+    private:
+        std::string Name;
+        std::unique_ptr<SpscQueue<RealEvent>> Spsc;
+        std::unique_ptr<MpmcQueue<RealEvent>> Mpmc;
+    };
+
+    // each thread has own stats, they are merged when threads are stopped
+    struct ThreadStats {
+        Histogram WaitTimeUs = Histogram::HistogramWithUsBuckets();
+        Histogram StageTimeUs = Histogram::HistogramWithUsBuckets();
+        Histogram EventDurationsUs = Histogram::HistogramWithUsBuckets();
+        size_t FinishedEvents = 0;
+    };
+
+    struct ActiveStage {
+        const StageConfig* Config;
+        Channel* Input = nullptr;
+        Channel* Output = nullptr; // nullptr for the last stage
+        std::vector<std::unique_ptr<ThreadStats>> Stats;
+    };
+
+public:
+    RealThreadPipeLine() = default;
+
+    void AddQueue(const char* name, size_t initialEvents = 0) {
+        StageConfigs.push_back({EStageKind::Queue, name, initialEvents, 1, 0, {}});
+    }
+
+    void AddThreadHandoff(const char* name, ThreadHandoffConfig) {
+        AddQueue(name);
+    }
+
+    void AddFixedTimeExecutor(const char* name, size_t processorCount, SimTime executionTime) {
+        StageConfigs.push_back({EStageKind::Workers, name, 0, processorCount, executionTime, {}});
+    }
+
+    void AddPercentileTimeExecutor(const char* name, size_t processorCount, PercentileTimeProcessor::Percentiles percentiles) {
+        StageConfigs.push_back({EStageKind::Device, name, 0, processorCount, 0, std::move(percentiles)});
+    }
+
+    void AddFlushController(const char* name) {
+        StageConfigs.push_back({EStageKind::Flush, name, 0, 1, 0, {}});
+    }
+
+    // blocks for the given (real) time
+    void Run(SimTime duration) {
+        Build();
+        BusyWork::Calibrate();
+
+        auto now = Clock::now();
+        for (size_t i = 0; i < StageConfigs.front().InitialEvents; ++i) {
+            RealEvent event;
+            event.Id = ++EventCounter;
+            event.StartTime = now;
+            event.StageStarted = now;
+            PushBlocking(*ActiveStages.front().Input, event);
+        }
+
+        Stop = false;
+        std::vector<std::thread> threads;
+        for (auto& stage: ActiveStages) {
+            for (auto& stats: stage.Stats) {
+                threads.emplace_back([this, &stage, stats = stats.get()] {
+                    switch (stage.Config->Kind) {
+                    case EStageKind::Workers:
+                        RunWorker(stage, *stats);
+                        break;
+                    case EStageKind::Device:
+                        RunDevice(stage, *stats);
+                        break;
+                    case EStageKind::Flush:
+                        RunFlush(stage, *stats);
+                        break;
+                    case EStageKind::Queue:
+                        break;
+                    }
+                });
+            }
+        }
+
+        auto startTime = Clock::now();
+        std::this_thread::sleep_for(std::chrono::nanoseconds(duration));
+        Stop = true;
+
+        for (auto& thread: threads) {
+            thread.join();
+        }
+
+        TotalTimePassed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - startTime).count();
+
+        for (auto& stats: ActiveStages.back().Stats) {
+            TotalFinishedEvents += stats->FinishedEvents;
+            EventDurationsUs.Merge(stats->EventDurationsUs);
+        }
+
+        AvgRPS = (size_t)(TotalFinishedEvents * Sec / TotalTimePassed);
+    }
+
+    // the same summary as the simulation shows, plus the per-stage times
+    std::string GetStatsText() {
+        std::string result = FormatLatencyStats(TotalTimePassed, TotalFinishedEvents, AvgRPS, EventDurationsUs);
+        result += "\n";
+
+        for (auto& stage: ActiveStages) {
+            auto waitTimeUs = Histogram::HistogramWithUsBuckets();
+            auto stageTimeUs = Histogram::HistogramWithUsBuckets();
+            for (auto& stats: stage.Stats) {
+                waitTimeUs.Merge(stats->WaitTimeUs);
+                stageTimeUs.Merge(stats->StageTimeUs);
+            }
+
+            char text[256];
+            snprintf(text, sizeof(text), "%s: p50: %d us, p90: %d us; %s: p50: %d us, p90: %d us\n",
+                stage.Input->GetName().c_str(), waitTimeUs.GetPercentile(50), waitTimeUs.GetPercentile(90),
+                stage.Config->Name, stageTimeUs.GetPercentile(50), stageTimeUs.GetPercentile(90));
+            result += text;
+        }
+
+        return result;
+    }
+
+private:
+    void Build() {
+        if (StageConfigs.empty() || StageConfigs.front().Kind != EStageKind::Queue) {
+            throw std::runtime_error("The first stage must be the input queue");
+        }
+
+        size_t population = 0;
+        for (const auto& config: StageConfigs) {
+            population += config.InitialEvents;
+        }
+
+        // closed loop: the number of events never changes, so queues never overflow
+        size_t capacity = std::max<size_t>(population * 2, 1024);
+
+        std::vector<std::string> inputNames;
+        const char* queueName = nullptr;
+        const char* prevName = nullptr;
+        for (const auto& config: StageConfigs) {
+            if (config.Kind == EStageKind::Queue) {
+                if (queueName) {
+                    throw std::runtime_error("Two queues in a row are not supported");
+                }
+                queueName = config.Name;
+                continue;
+            }
+
+            if (queueName) {
+                inputNames.push_back(queueName);
+            } else {
+                inputNames.push_back(std::string(prevName) + "->" + config.Name);
+            }
+
+            ActiveStages.push_back({&config, nullptr, nullptr, {}});
+            size_t threadCount = config.Kind == EStageKind::Workers ? config.ProcessorCount : 1;
+            for (size_t i = 0; i < threadCount; ++i) {
+                ActiveStages.back().Stats.emplace_back(std::make_unique<ThreadStats>());
+            }
+
+            queueName = nullptr;
+            prevName = config.Name;
+        }
+
+        if (ActiveStages.empty() || queueName) {
+            throw std::runtime_error("The last stage must not be a queue");
+        }
+
+        for (size_t i = 0; i < ActiveStages.size(); ++i) {
+            // the first stage is fed by the last one
+            auto& producer = i == 0 ? ActiveStages.back() : ActiveStages[i - 1];
+            auto& consumer = ActiveStages[i];
+            Channels.emplace_back(std::make_unique<Channel>(
+                inputNames[i], producer.Stats.size(), consumer.Stats.size(), capacity));
+
+            consumer.Input = Channels.back().get();
+            if (i != 0) {
+                producer.Output = consumer.Input;
+            }
+        }
+    }
+
+    static void PushBlocking(Channel& channel, const RealEvent& event) {
+        SpinWait spinWait;
+        while (!channel.TryPush(event)) {
+            spinWait.Wait();
+        }
+    }
+
+    static int ToUs(Clock::duration duration) {
+        return (int)std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+    void Forward(ActiveStage& stage, RealEvent event, ThreadStats& stats) {
+        auto now = Clock::now();
+        if (stage.Output) {
+            event.StageStarted = now;
+            PushBlocking(*stage.Output, event);
+            return;
+        }
+
+        // closed loop: finish the event and start the new one
+        ++stats.FinishedEvents;
+        stats.EventDurationsUs.AddDuration(ToUs(now - event.StartTime));
+
+        RealEvent newEvent;
+        newEvent.Id = ++EventCounter;
+        newEvent.StartTime = now;
+        newEvent.StageStarted = now;
+        PushBlocking(*ActiveStages.front().Input, newEvent);
+    }
+
+    bool TryPopInput(ActiveStage& stage, RealEvent& event, ThreadStats& stats) {
+        if (!stage.Input->TryPop(event)) {
+            return false;
+        }
+
+        auto now = Clock::now();
+        stats.WaitTimeUs.AddDuration(ToUs(now - event.StageStarted));
+        event.StageStarted = now;
+        return true;
+    }
+
+    void RunWorker(ActiveStage& stage, ThreadStats& stats) {
+        SpinWait spinWait;
+        while (!Stop.load(std::memory_order_relaxed)) {
+            RealEvent event;
+            if (!TryPopInput(stage, event, stats)) {
+                spinWait.Wait();
+                continue;
+            }
+            spinWait.Reset();
+
+            BusyWork::Run(stage.Config->ExecutionTime);
+            stats.StageTimeUs.AddDuration(ToUs(Clock::now() - event.StageStarted));
+
+            Forward(stage, event, stats);
+        }
+    }
+
+    void RunDevice(ActiveStage& stage, ThreadStats& stats) {
+        using InflightEvent = std::pair<Clock::time_point, RealEvent>;
+        auto later = [](const InflightEvent& lhs, const InflightEvent& rhs) {
+            return lhs.first > rhs.first;
+        };
+        std::priority_queue<InflightEvent, std::vector<InflightEvent>, decltype(later)> inflight(later);
+
+        std::mt19937 gen(std::random_device{}());
+        std::uniform_real_distribution<> dis(0, 100);
+
+        SpinWait spinWait;
+        while (!Stop.load(std::memory_order_relaxed)) {
+            bool progress = false;
+
+            RealEvent event;
+            while (inflight.size() < stage.Config->ProcessorCount && TryPopInput(stage, event, stats)) {
+                auto serviceTime = PercentileTimeProcessor::Sample(stage.Config->Percentiles, dis(gen));
+                auto deadline = event.StageStarted + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::nanoseconds(serviceTime));
+                inflight.emplace(deadline, event);
+                progress = true;
+            }
+
+            auto now = Clock::now();
+            while (!inflight.empty() && inflight.top().first <= now) {
+                auto finished = inflight.top().second;
+                inflight.pop();
+                stats.StageTimeUs.AddDuration(ToUs(now - finished.StageStarted));
+                Forward(stage, finished, stats);
+                progress = true;
+            }
+
+            if (progress) {
+                spinWait.Reset();
+            } else {
+                spinWait.Wait();
+            }
+        }
+    }
+
+    void RunFlush(ActiveStage& stage, ThreadStats& stats) {
+        std::map<size_t, RealEvent> waitingEvents;
+        size_t finishedEventsBarrier = 0; // all events with Id <= barrier are finished
+
+        SpinWait spinWait;
+        while (!Stop.load(std::memory_order_relaxed)) {
+            RealEvent event;
+            if (!TryPopInput(stage, event, stats)) {
+                spinWait.Wait();
+                continue;
+            }
+            spinWait.Reset();
+
+            waitingEvents.emplace(event.Id, event);
+
+            while (!waitingEvents.empty() && waitingEvents.begin()->first - 1 == finishedEventsBarrier) {
+                auto finished = waitingEvents.begin()->second;
+                waitingEvents.erase(waitingEvents.begin());
+                finishedEventsBarrier = finished.Id;
+
+                stats.StageTimeUs.AddDuration(ToUs(Clock::now() - finished.StageStarted));
+                Forward(stage, finished, stats);
+            }
+        }
+    }
+
+private:
+    std::vector<StageConfig> StageConfigs;
+    std::vector<ActiveStage> ActiveStages;
+    std::vector<std::unique_ptr<Channel>> Channels;
+
+    std::atomic<bool> Stop{false};
+    std::atomic<size_t> EventCounter{0};
+
+    size_t TotalFinishedEvents = 0;
+    SimTime TotalTimePassed = 0;
+
+    Histogram EventDurationsUs = Histogram::HistogramWithUsBuckets();
+    size_t AvgRPS = 0;
+};
+
+} // namespace queue_sim
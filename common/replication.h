@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "engine/easy.h"
+#include "engine/easy_drawing.h"
+#include "engine/easy_sprite.h"
+
+#include "common.h"
+#include "simple_pipeline.h"
+
+// Replicated write: one logical event is sent to R independent replicas
+// (e.g. network hop -> PDisk -> network hop), the write is finished once
+// k of R replicas have responded. Remaining replicas are stragglers.
+
+namespace queue_sim {
+
+// ----------------------------
+// ReplicatedWrite: fan-out to replicas and quorum join
+
+class ReplicatedWrite final : public ItemBase {
+private:
+    struct PendingWrite {
+        Event _Event;
+        SimTime PushTs = 0;
+        SimTime QuorumTs = 0;
+        size_t Responses = 0;
+
+        // cancelled writes wait only for the replicas, which couldn't cancel
+        bool Cancelled = false;
+        size_t CancelledReplicas = 0;
+    };
+
+public:
+    using SetupReplica = std::function<void(StageChain& chain, size_t replica)>;
+
+    ReplicatedWrite(const char* name, size_t replicaCount, size_t quorum, const SetupReplica& setupReplica)
+        : Name(name)
+        , Quorum(quorum)
+        , QuorumTimeUs(Histogram::HistogramWithUsBuckets())
+        , StragglerLagUs(Histogram::HistogramWithUsBuckets())
+        , StragglerCounts(replicaCount, 0)
+    {
+        if (quorum == 0 || quorum > replicaCount) {
+            throw std::runtime_error("Quorum must be in [1, replicas]");
+        }
+
+        for (size_t i = 0; i < replicaCount; ++i) {
+            Replicas.emplace_back(std::make_unique<StageChain>());
+            setupReplica(*Replicas.back(), i);
+            if (Replicas.back()->GetStageCount() == 0) {
+                throw std::runtime_error("Replica must have stages");
+            }
+            ReplicaTimeUs.emplace_back(Histogram::HistogramWithUsBuckets());
+        }
+    }
+
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime dt) override {
+        for (size_t i = 0; i < Replicas.size(); ++i) {
+            auto& replica = *Replicas[i];
+            replica.Tick(dt);
+
+            auto& lastStage = replica.Back();
+            while (lastStage.IsReadyToPopEvent()) {
+                OnResponse(i, lastStage.PopEvent());
+            }
+        }
+    }
+
+    bool IsReadyToPushEvent() const override {
+        for (const auto& replica: Replicas) {
+            if (!replica->Front().IsReadyToPushEvent()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void PushEvent(Event event) override {
+        event.StartStage();
+        Pending.emplace(event.GetId(), PendingWrite{event, Now()});
+
+        for (auto& replica: Replicas) {
+            replica->Front().PushEvent(event);
+        }
+    }
+
+    bool IsReadyToPopEvent() const override {
+        return !Finished.empty();
+    }
+
+    Event PopEvent() override {
+        if (!IsReadyToPopEvent()) {
+            throw std::runtime_error("No events ready");
+        }
+
+        auto event = Finished.front();
+        Finished.pop_front();
+        return event;
+    }
+
+    bool CancelEvent(size_t id) override {
+        // the quorum might be already reached
+        auto finishedIt = std::find_if(Finished.begin(), Finished.end(),
+            [id](const Event& event) { return event.GetId() == id; });
+        bool wasFinished = finishedIt != Finished.end();
+        if (wasFinished) {
+            Finished.erase(finishedIt);
+        }
+
+        auto it = Pending.find(id);
+        if (it == Pending.end()) {
+            return wasFinished;
+        }
+
+        auto& write = it->second;
+        write.Cancelled = true;
+        for (auto& replica: Replicas) {
+            if (replica->CancelEvent(id)) {
+                ++write.CancelledReplicas;
+            }
+        }
+
+        // the quorum has been reached and the write has already left, only stragglers are cancelled
+        bool hasLeft = write.Responses >= Quorum && !wasFinished;
+
+        if (write.Responses + write.CancelledReplicas == Replicas.size()) {
+            Pending.erase(it);
+        }
+
+        return !hasLeft;
+    }
+
+    // writes waiting for the quorum and finished ones
+    size_t GetEventCount() const override {
+        size_t count = Finished.size();
+        for (const auto& [id, write]: Pending) {
+            count += !write.Cancelled && write.Responses < Quorum;
+        }
+        return count;
+    }
+
+    const Histogram* GetServiceTimeUs() const override {
+        return &QuorumTimeUs;
+    }
+
+    const Histogram& GetQuorumTimeUs() const {
+        return QuorumTimeUs;
+    }
+
+    // time between the quorum and the last replica's response
+    const Histogram& GetStragglerLagUs() const {
+        return StragglerLagUs;
+    }
+
+    const Histogram& GetReplicaTimeUs(size_t replica) const {
+        return ReplicaTimeUs.at(replica);
+    }
+
+    // how many times the replica has responded after the quorum
+    size_t GetStragglerCount(size_t replica) const {
+        return StragglerCounts.at(replica);
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        for (const auto& replica: Replicas) {
+            replica->SaveStages(writer);
+        }
+
+        writer.Write(Pending.size());
+        for (const auto& [id, write]: Pending) {
+            write._Event.Save(writer);
+            writer.Write(write.PushTs);
+            writer.Write(write.QuorumTs);
+            writer.Write(write.Responses);
+            writer.Write(write.Cancelled);
+            writer.Write(write.CancelledReplicas);
+        }
+
+        writer.Write(Finished.size());
+        for (const auto& event: Finished) {
+            event.Save(writer);
+        }
+
+        QuorumTimeUs.Save(writer);
+        StragglerLagUs.Save(writer);
+        for (size_t i = 0; i < Replicas.size(); ++i) {
+            ReplicaTimeUs[i].Save(writer);
+            writer.Write(StragglerCounts[i]);
+        }
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        for (auto& replica: Replicas) {
+            replica->LoadStages(reader);
+        }
+
+        Pending.clear();
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            PendingWrite write{Event::Load(reader)};
+            reader.Read(write.PushTs);
+            reader.Read(write.QuorumTs);
+            reader.Read(write.Responses);
+            reader.Read(write.Cancelled);
+            reader.Read(write.CancelledReplicas);
+            Pending.emplace(write._Event.GetId(), write);
+        }
+
+        Finished.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            Finished.push_back(Event::Load(reader));
+        }
+
+        QuorumTimeUs.Load(reader);
+        StragglerLagUs.Load(reader);
+        for (size_t i = 0; i < Replicas.size(); ++i) {
+            ReplicaTimeUs[i].Load(reader);
+            reader.Read(StragglerCounts[i]);
+        }
+    }
+
+public:
+    void Draw(arctic::Sprite toSprite) override {
+        char text[256];
+        snprintf(text, sizeof(text), "%s: %ld/%ld, %ld\np90: %d us\nStragglers p90: %d us",
+            Name, Quorum, Replicas.size(), Pending.size(),
+            QuorumTimeUs.GetPercentile(90), StragglerLagUs.GetPercentile(90));
+        GetFont().Draw(toSprite, text, 5, toSprite.Height() / 2);
+    }
+
+private:
+    void OnResponse(size_t replica, const Event& response) {
+        auto it = Pending.find(response.GetId());
+        if (it == Pending.end()) {
+            throw std::runtime_error("Replica responded to unknown write");
+        }
+
+        auto& write = it->second;
+        if (write.Cancelled) {
+            if (++write.Responses + write.CancelledReplicas == Replicas.size()) {
+                Pending.erase(it);
+            }
+            return;
+        }
+
+        auto now = Now();
+        ReplicaTimeUs[replica].AddTime(now - write.PushTs);
+
+        ++write.Responses;
+        if (write.Responses == Quorum) {
+            write.QuorumTs = now;
+            QuorumTimeUs.AddTime(now - write.PushTs);
+            Finished.push_back(write._Event);
+        } else if (write.Responses > Quorum) {
+            ++StragglerCounts[replica];
+        }
+
+        if (write.Responses == Replicas.size()) {
+            StragglerLagUs.AddTime(now - write.QuorumTs);
+            Pending.erase(it);
+        }
+    }
+
+private:
+    const char* Name;
+    size_t Quorum;
+    std::vector<std::unique_ptr<StageChain>> Replicas;
+
+    // writes, which haven't got all responses yet
+    std::map<size_t, PendingWrite> Pending;
+    std::deque<Event> Finished;
+
+    Histogram QuorumTimeUs;
+    Histogram StragglerLagUs;
+    std::vector<Histogram> ReplicaTimeUs;
+    std::vector<size_t> StragglerCounts;
+};
+
+} // namespace queue_sim
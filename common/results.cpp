@@ -0,0 +1,143 @@
+#include "results.h"
+
+namespace queue_sim {
+
+// ----------------------------
+// JSON helpers
+
+static std::string JsonString(const std::string& value) {
+    std::string result = "\"";
+    for (char c: value) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result + "\"";
+}
+
+static std::string JsonNumber(double value) {
+    char text[64];
+    snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+}
+
+// ----------------------------
+// LatencyResults
+
+std::string LatencyResults::ToJson() const {
+    return "{\"count\": " + std::to_string(Count)
+        + ", \"mean\": " + (MeanUs ? JsonNumber(*MeanUs) : "null")
+        + ", \"p50\": " + std::to_string(P50Us)
+        + ", \"p90\": " + std::to_string(P90Us)
+        + ", \"p99\": " + std::to_string(P99Us)
+        + ", \"p99.9\": " + std::to_string(P999Us)
+        + ", \"max\": " + std::to_string(MaxUs)
+        + "}";
+}
+
+// ----------------------------
+// LittleLawCheck
+
+std::string LittleLawCheck::ToJson() const {
+    return "{\"avg_events\": " + JsonNumber(AvgEvents)
+        + ", \"throughput_x_latency\": " + JsonNumber(ThroughputTimesLatency)
+        + ", \"relative_error\": " + JsonNumber(GetRelativeError())
+        + "}";
+}
+
+// ----------------------------
+// StageResults
+
+std::string StageResults::ToJson() const {
+    return "{\"name\": " + JsonString(Name)
+        + ", \"departures\": " + std::to_string(Departures)
+        + ", \"throughput_rps\": " + JsonNumber(ThroughputRps)
+        + ", \"sojourn_us\": " + SojournUs.ToJson()
+        + ", \"service_us\": " + (ServiceUs ? ServiceUs->ToJson() : "null")
+        + ", \"throttling_us\": " + (ThrottlingUs ? ThrottlingUs->ToJson() : "null")
+        + ", \"littles_law\": " + LittleLaw.ToJson()
+        + "}";
+}
+
+// ----------------------------
+// TenantResults
+
+std::string TenantResults::ToJson() const {
+    return "{\"id\": " + std::to_string(Id)
+        + ", \"finished_events\": " + std::to_string(FinishedEvents)
+        + ", \"timed_out_events\": " + std::to_string(TimedOutEvents)
+        + ", \"throughput_rps\": " + JsonNumber(ThroughputRps)
+        + ", \"intended_rate_rps\": " + JsonNumber(IntendedRateRps)
+        + ", \"intended_start_latency_us\": " + IntendedStartLatencyUs.ToJson()
+        + "}";
+}
+
+// ----------------------------
+// PipeLineResults
+
+std::string PipeLineResults::ToJson() const {
+    std::string tenants;
+    for (const auto& tenant: Tenants) {
+        tenants += tenants.empty() ? "\n    " : ",\n    ";
+        tenants += tenant.ToJson();
+    }
+
+    std::string stages;
+    for (const auto& stage: Stages) {
+        stages += stages.empty() ? "\n    " : ",\n    ";
+        stages += stage.ToJson();
+    }
+
+    return "{\n  \"time_passed_s\": " + JsonNumber(TimePassedS)
+        + ",\n  \"finished_events\": " + std::to_string(FinishedEvents)
+        + ",\n  \"timed_out_events\": " + std::to_string(TimedOutEvents)
+        + ",\n  \"throughput_rps\": " + JsonNumber(ThroughputRps)
+        + ",\n  \"intended_rate_rps\": " + JsonNumber(IntendedRateRps)
+        + ",\n  \"intended_start_latency_us\": " + IntendedStartLatencyUs.ToJson()
+        + ",\n  \"service_latency_us\": " + ServiceLatencyUs.ToJson()
+        + ",\n  \"littles_law\": " + LittleLaw.ToJson()
+        + ",\n  \"tenants\": [" + tenants + "\n  ]"
+        + ",\n  \"stages\": [" + stages + "\n  ]\n}";
+}
+
+std::string PipeLineResults::GetStagesText() const {
+    std::string result;
+    char text[256];
+    for (const auto& stage: Stages) {
+        snprintf(text, sizeof(text), "%s: sojourn p50: %d us, p99: %d us",
+            stage.Name.c_str(), stage.SojournUs.P50Us, stage.SojournUs.P99Us);
+        result += text;
+
+        if (stage.ServiceUs) {
+            snprintf(text, sizeof(text), "; service p50: %d us, p99: %d us",
+                stage.ServiceUs->P50Us, stage.ServiceUs->P99Us);
+            result += text;
+        }
+
+        if (stage.ThrottlingUs) {
+            snprintf(text, sizeof(text), "; throttling p50: %d us, p99: %d us",
+                stage.ThrottlingUs->P50Us, stage.ThrottlingUs->P99Us);
+            result += text;
+        }
+
+        snprintf(text, sizeof(text), "; L: %.2f, lambda*W: %.2f\n",
+            stage.LittleLaw.AvgEvents, stage.LittleLaw.ThroughputTimesLatency);
+        result += text;
+    }
+    return result;
+}
+
+std::string PipeLineResults::GetTenantsText() const {
+    std::string result;
+    char text[256];
+    for (const auto& tenant: Tenants) {
+        snprintf(text, sizeof(text), "Tenant %ld: %.0f rps (intended %.0f), p50: %d us, p99: %d us, p99.9: %d us\n",
+            tenant.Id, tenant.ThroughputRps, tenant.IntendedRateRps, tenant.IntendedStartLatencyUs.P50Us,
+            tenant.IntendedStartLatencyUs.P99Us, tenant.IntendedStartLatencyUs.P999Us);
+        result += text;
+    }
+    return result;
+}
+
+} // namespace queue_sim
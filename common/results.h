@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+// Results of a pipeline run: latencies from the intended and from the actual start,
+// per-stage sojourn and service times, Little's law checks. Units are in the names:
+// Us - microseconds, S - seconds, Rps - events per second. Percentiles are upper
+// bounds of the histogram buckets, means are exact.
+
+namespace queue_sim {
+
+// ----------------------------
+// LatencyResults
+
+struct LatencyResults {
+    size_t Count = 0;
+    std::optional<double> MeanUs; // unknown, when only the histogram is collected
+    int P50Us = 0;
+    int P90Us = 0;
+    int P99Us = 0;
+    int P999Us = 0;
+    int MaxUs = 0;
+
+    static LatencyResults FromHistogram(const Histogram& durationsUs, std::optional<double> meanUs = {}) {
+        LatencyResults results;
+        results.Count = durationsUs.GetCount();
+        results.MeanUs = meanUs;
+        if (results.Count != 0) {
+            results.P50Us = durationsUs.GetPercentile(50);
+            results.P90Us = durationsUs.GetPercentile(90);
+            results.P99Us = durationsUs.GetPercentile(99);
+            results.P999Us = durationsUs.GetPercentile(99.9);
+            results.MaxUs = durationsUs.GetPercentile(100);
+        }
+        return results;
+    }
+
+    std::string ToJson() const;
+};
+
+// ----------------------------
+// LittleLawCheck: L = lambda * W, where L is measured as the time-average number of events
+// and W by timestamps. A mismatch means, that events are lost or timestamps are wrong.
+// Events in flight at the end of the run (and cancelled ones) make a small difference
+
+struct LittleLawCheck {
+    double AvgEvents = 0;             // L
+    double ThroughputTimesLatency = 0; // lambda * W
+
+    double GetRelativeError() const {
+        if (AvgEvents == 0) {
+            return ThroughputTimesLatency == 0 ? 0 : 1;
+        }
+        return std::abs(AvgEvents - ThroughputTimesLatency) / AvgEvents;
+    }
+
+    std::string ToJson() const;
+};
+
+// ----------------------------
+// StageResults
+
+struct StageResults {
+    std::string Name;
+    size_t Departures = 0;
+    double ThroughputRps = 0;
+
+    // from push to pop, i.e. including waiting for the next stage
+    LatencyResults SojournUs;
+
+    // see ItemBase::GetServiceTimeUs
+    std::optional<LatencyResults> ServiceUs;
+
+    // see ItemBase::GetThrottlingDelayUs, the rest of departures have been admitted at once
+    std::optional<LatencyResults> ThrottlingUs;
+
+    LittleLawCheck LittleLaw;
+
+    std::string ToJson() const;
+};
+
+// ----------------------------
+// TenantResults
+
+struct TenantResults {
+    size_t Id = 0;
+    size_t FinishedEvents = 0;
+    size_t TimedOutEvents = 0;
+    double ThroughputRps = 0;
+    double IntendedRateRps = 0;
+    LatencyResults IntendedStartLatencyUs;
+
+    std::string ToJson() const;
+};
+
+// ----------------------------
+// PipeLineResults
+
+struct PipeLineResults {
+    double TimePassedS = 0;
+    size_t FinishedEvents = 0;
+    size_t TimedOutEvents = 0;
+    double ThroughputRps = 0;
+
+    // 0, when events are issued as soon as clients are free
+    double IntendedRateRps = 0;
+
+    // from the moment, when the event should have been issued, i.e. including the time
+    // the client has waited for the previous event. Not affected by coordinated omission
+    LatencyResults IntendedStartLatencyUs;
+
+    // from the moment, when the event has been issued
+    LatencyResults ServiceLatencyUs;
+
+    // note, that in both latencies timed out events are counted at their deadlines
+
+    // tenants of the clients, see PipeLineClients
+    std::vector<TenantResults> Tenants;
+
+    std::vector<StageResults> Stages;
+
+    // for the whole pipeline, W is the service latency
+    LittleLawCheck LittleLaw;
+
+    double GetMaxLittleLawError() const {
+        double maxError = LittleLaw.GetRelativeError();
+        for (const auto& stage: Stages) {
+            maxError = std::max(maxError, stage.LittleLaw.GetRelativeError());
+        }
+        return maxError;
+    }
+
+    std::string ToJson() const;
+
+    void SaveJson(const std::string& path) const {
+        std::ofstream file(path);
+        if (!file) {
+            throw std::runtime_error("Failed to save results to " + path);
+        }
+        file << ToJson() << "\n";
+    }
+
+    // per-stage table for the console
+    std::string GetStagesText() const;
+
+    // per-tenant table for the console
+    std::string GetTenantsText() const;
+};
+
+} // namespace queue_sim
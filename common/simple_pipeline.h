@@ -1,17 +1,26 @@
 #pragma once
 
 #include <algorithm>
+#include <cstring>
 #include <deque>
+#include <functional>
+#include <map>
 #include <optional>
 #include <memory>
 #include <random>
 #include <set>
+#include <string>
+#include <typeinfo>
 
 #include "engine/easy.h"
 #include "engine/easy_drawing.h"
 #include "engine/easy_sprite.h"
 
 #include "common.h"
+#include "network_link.h"
+#include "nvme_device.h"
+#include "results.h"
+#include "thread_handoff.h"
 
 // Implements a simple pipeline: queue -> Executor<Processor> -> Executor<Processor> -> queue -> ...
 
@@ -22,7 +31,7 @@ using namespace arctic;  // NOLINT
 // ----------------------------
 // FlushController: events should wait all previous events to finish
 
-class FlushController : public ItemBase {
+class FlushController final : public ItemBase {
 public:
     FlushController(const char* name)
         : Name(name)
@@ -30,7 +39,11 @@ public:
     {
     }
 
-    void Tick(double) override {
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void Tick(SimTime) override {
         /* do nothing */
     }
 
@@ -39,12 +52,17 @@ public:
     }
 
     void PushEvent(Event event) override {
+        // the event has been cancelled, while it was in a stage, which can't cancel
+        if (event.GetId() <= FinishedEventsBarrier || CancelledIds.count(event.GetId())) {
+            return;
+        }
+
         event.StartStage();
         WaitingEvents.insert(event);
     }
 
     bool IsReadyToPopEvent() const override {
-        if (WaitingEvents.empty()) {
+        if (WaitingEvents.empty() || Fault.BlocksPop()) {
             return false;
         }
 
@@ -65,13 +83,66 @@ public:
             throw std::runtime_error("Oops, something went wrong with flush controller");
         }
 
-        WaitingTimeUs.AddDuration((int)(event.GetStageDuration() * 1000000));
+        WaitingTimeUs.AddTime(event.GetStageDuration());
 
         FinishedEventsBarrier = event.GetId();
+        SkipCancelled();
 
         return event;
     }
 
+    size_t GetEventCount() const override {
+        return WaitingEvents.size();
+    }
+
+    // the following events don't wait for the cancelled one
+    bool CancelEvent(size_t id) override {
+        // already left, or has been cancelled before
+        if (id <= FinishedEventsBarrier) {
+            return false;
+        }
+
+        auto it = std::find_if(WaitingEvents.begin(), WaitingEvents.end(),
+            [id](const Event& event) { return event.GetId() == id; });
+        if (it != WaitingEvents.end()) {
+            WaitingEvents.erase(it);
+        }
+
+        CancelledIds.insert(id);
+        SkipCancelled();
+        return true;
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        WaitingTimeUs.Save(writer);
+        writer.Write(FinishedEventsBarrier);
+        writer.Write(WaitingEvents.size());
+        for (const auto& event: WaitingEvents) {
+            event.Save(writer);
+        }
+        writer.Write(CancelledIds.size());
+        for (auto id: CancelledIds) {
+            writer.Write(id);
+        }
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        WaitingTimeUs.Load(reader);
+        reader.Read(FinishedEventsBarrier);
+
+        WaitingEvents.clear();
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            WaitingEvents.insert(Event::Load(reader));
+        }
+
+        CancelledIds.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            CancelledIds.insert(reader.Read<size_t>());
+        }
+    }
+
 public:
     void Draw(Sprite toSprite) override {
         auto width = toSprite.Width();
@@ -91,50 +162,283 @@ public:
         GetFont().Draw(toSprite, text, 10, yPos + minDimension / 2);
     }
 
+private:
+    void SkipCancelled() {
+        while (!CancelledIds.empty() && *CancelledIds.begin() == FinishedEventsBarrier + 1) {
+            CancelledIds.erase(CancelledIds.begin());
+            ++FinishedEventsBarrier;
+        }
+    }
+
 private:
     const char* Name;
     Histogram WaitingTimeUs;
 
-    size_t FinishedEventsBarrier = 0; // all events with Id <= barrier are finished
+    size_t FinishedEventsBarrier = 0; // all events with Id <= barrier are finished or cancelled
     std::set<Event> WaitingEvents;
+    std::set<size_t> CancelledIds; // cancelled events above the barrier
 };
 
 // ----------------------------
-// ClosedPipeLine
+// Helpers shared by the pipelines, stages is a range of (smart) pointers to ItemBase
 
-// assumes, that the first stage is the input queue. Finished events are pushed back to the input queue
-class ClosedPipeLine {
-public:
-    ClosedPipeLine(Sprite sprite)
-        : _Sprite(sprite)
-        , EventDurationsUs(Histogram::HistogramWithUsBuckets())
-    {
+constexpr uint64_t PipeLineSnapshotMagic = 0x38544e5350534451; // "QDSPSNT8"
+
+template <typename TStages>
+void SaveStageStates(SnapshotWriter& writer, const TStages& stages) {
+    writer.Write(stages.size());
+    for (const auto& stage: stages) {
+        writer.WriteString(typeid(*stage).name());
+        stage->SaveState(writer);
+    }
+}
+
+template <typename TStages>
+void LoadStageStates(SnapshotReader& reader, TStages& stages) {
+    if (reader.Read<size_t>() != stages.size()) {
+        throw std::runtime_error("Snapshot has different number of stages");
+    }
+
+    for (auto& stage: stages) {
+        if (reader.ReadString() != typeid(*stage).name()) {
+            throw std::runtime_error("Snapshot has different stages");
+        }
+        stage->LoadState(reader);
+    }
+}
+
+template <typename TStages>
+void DrawStages(Sprite sprite, const TStages& stages, const std::string& statsText) {
+    auto stageCount = stages.size();
+    auto width = sprite.Width();
+    auto height = sprite.Height();
+
+    const Si32 spacing = 5;
+    const Si32 widthWithoutSpacing = width - spacing * 2;
+    const Si32 heightWithoutSpacing = height - spacing * 2;
+    const Si32 footerHeight = 100;
+
+    size_t space_between_stages = 50;
+    Si32 stage_width = ((widthWithoutSpacing - space_between_stages * (stageCount - 1))) / stageCount;
+    Si32 stage_height = heightWithoutSpacing - footerHeight;
+
+    for (size_t i = 0; i < stageCount; ++i) {
+        auto& stage = stages[i];
+        Si32 x = i * (stage_width + space_between_stages) + spacing;
+        Si32 y = spacing + footerHeight;
+        Sprite stageSprite;
+        stageSprite.Reference(sprite, x, y, stage_width, stage_height);
+        stage->Draw(stageSprite);
+
+        if (i != 0) {
+            Si32 prevX = x - space_between_stages;
+            Si32 middleY = y + stage_height / 2;
+            Vec2F src(prevX, middleY);
+            Vec2F dst(x, middleY);
+            DrawArrow(sprite, src, dst, 5, 20, 10, Rgba(0, 0, 0));
+        }
+    }
+
+    DrawRectangle(
+        sprite,
+        arctic::Vec2Si32(spacing, spacing + footerHeight * 2.8),
+        arctic::Vec2Si32(width - spacing, footerHeight * 2.8 + 100),
+        YDBColorDarkViolet);
+    GetFont().Draw(sprite, statsText.c_str(), spacing * 2, footerHeight * 2.8 + spacing + 5);
+}
+
+// ----------------------------
+// StageStats: collected by the chain for each of its stages
+
+struct StageStats {
+    size_t Departures = 0;
+    SimTime TotalSojourn = 0;
+    Histogram SojournUs = Histogram::HistogramWithUsBuckets();
+
+    // integral of the number of events in the stage over time
+    SimTime TotalEventTime = 0;
+
+    void Save(SnapshotWriter& writer) const {
+        writer.Write(Departures);
+        writer.Write(TotalSojourn);
+        SojournUs.Save(writer);
+        writer.Write(TotalEventTime);
+    }
+
+    void Load(SnapshotReader& reader) {
+        reader.Read(Departures);
+        reader.Read(TotalSojourn);
+        SojournUs.Load(reader);
+        reader.Read(TotalEventTime);
+    }
+};
+
+inline void SaveStageStats(SnapshotWriter& writer, const std::vector<StageStats>& stats, SimTime statsTime) {
+    writer.Write(stats.size());
+    for (const auto& stageStats: stats) {
+        stageStats.Save(writer);
+    }
+    writer.Write(statsTime);
+}
+
+inline void LoadStageStats(SnapshotReader& reader, std::vector<StageStats>& stats, SimTime& statsTime) {
+    stats.resize(reader.Read<size_t>());
+    for (auto& stageStats: stats) {
+        stageStats.Load(reader);
+    }
+    reader.Read(statsTime);
+}
+
+// stats[i] are of stages[i], the last stage's departures are counted by the owner of the stages
+template <typename TStages, typename TStats>
+std::vector<StageResults> GetStageResults(const TStages& stages, const TStats& stats, SimTime statsTime) {
+    std::vector<StageResults> results;
+    for (size_t i = 0; i < stats.size(); ++i) {
+        const auto& stageStats = stats[i];
+        double timePassedS = ToSeconds(statsTime);
+
+        StageResults stage;
+        stage.Name = stages[i]->GetName();
+        stage.Departures = stageStats.Departures;
+        stage.ThroughputRps = timePassedS ? stageStats.Departures / timePassedS : 0;
+
+        std::optional<double> meanSojournUs;
+        if (stageStats.Departures) {
+            meanSojournUs = (double)stageStats.TotalSojourn / stageStats.Departures / Usec;
+        }
+        stage.SojournUs = LatencyResults::FromHistogram(stageStats.SojournUs, meanSojournUs);
+
+        if (auto* serviceTimeUs = stages[i]->GetServiceTimeUs()) {
+            stage.ServiceUs = LatencyResults::FromHistogram(*serviceTimeUs);
+        }
+        if (auto* throttlingDelayUs = stages[i]->GetThrottlingDelayUs()) {
+            stage.ThrottlingUs = LatencyResults::FromHistogram(*throttlingDelayUs);
+        }
+
+        if (statsTime) {
+            stage.LittleLaw.AvgEvents = (double)stageStats.TotalEventTime / statsTime;
+            stage.LittleLaw.ThroughputTimesLatency = (double)stageStats.TotalSojourn / statsTime;
+        }
+
+        results.push_back(std::move(stage));
     }
+    return results;
+}
 
+// ----------------------------
+// StageChain: stages connected one after another, events move from each stage to the next one
+
+class StageChain {
+public:
     void AddQueue(const char* name, size_t initialEvents = 0) {
-        Stages.emplace_back(new Queue(name, initialEvents));
+        AddItem(new Queue(name, initialEvents));
+    }
+
+    void AddThreadHandoff(const char* name, ThreadHandoffConfig config) {
+        AddItem(new ThreadHandoff(name, config));
     }
 
-    void AddFixedTimeExecutor(const char* name, size_t processorCount, double executionTime) {
-        Stages.emplace_back(new Executor<FixedTimeProcessor>(name, processorCount, executionTime));
+    void AddFixedTimeExecutor(const char* name, size_t processorCount, SimTime executionTime) {
+        AddItem(new Executor<FixedTimeProcessor>(name, processorCount, executionTime));
     }
 
     void AddPercentileTimeExecutor(const char* name, size_t processorCount, PercentileTimeProcessor::Percentiles percentiles) {
-        Stages.emplace_back(new Executor<PercentileTimeProcessor>(name, processorCount, percentiles));
+        AddItem(new Executor<PercentileTimeProcessor>(name, processorCount, percentiles));
+    }
+
+    void AddNVMeDevice(const char* name, NVMeDeviceConfig config) {
+        AddItem(new NVMeDevice(name, std::move(config)));
+    }
+
+    void AddNetworkLink(const char* name, NetworkLinkConfig config) {
+        AddItem(new NetworkLink(name, std::move(config)));
     }
 
     void AddFlushController(const char* name) {
-        Stages.emplace_back(new FlushController(name));
+        AddItem(new FlushController(name));
     }
 
-    void Tick(double dt) {
-        TotalTimePassed += dt;
+    // any other kind of stage
+    template <typename TStage, typename... Args>
+    TStage* AddStage(Args&&... args) {
+        auto* stage = new TStage(std::forward<Args>(args)...);
+        AddItem(stage);
+        return stage;
+    }
+
+    size_t GetStageCount() const {
+        return Stages.size();
+    }
+
+    ItemBase* FindStage(const char* name) {
+        for (auto& stage: Stages) {
+            if (strcmp(stage->GetName(), name) == 0) {
+                return stage.get();
+            }
+        }
+        throw std::runtime_error(std::string("No stage ") + name);
+    }
 
+    // see ItemBase::CancelEvent, all stages are notified: e.g. a flush controller
+    // must not wait for the event, which is cancelled by a previous stage
+    bool CancelEvent(size_t id) {
+        bool cancelled = false;
         for (auto& stage: Stages) {
+            cancelled = stage->CancelEvent(id) || cancelled;
+        }
+        return cancelled;
+    }
+
+    ItemBase& Front() {
+        return *Stages.front();
+    }
+
+    ItemBase& Back() {
+        return *Stages.back();
+    }
+
+    void Tick(SimTime dt) {
+        TickStages(dt);
+        TransferEvents();
+    }
+
+    // the last stage's departures are counted by the owner of the chain
+    std::vector<StageResults> GetStageResults() const {
+        return queue_sim::GetStageResults(Stages, Stats, StatsTime);
+    }
+
+    void SaveStages(SnapshotWriter& writer) const {
+        SaveStageStates(writer, Stages);
+        SaveStageStats(writer, Stats, StatsTime);
+    }
+
+    // the chain must have the same stages as the saved one
+    void LoadStages(SnapshotReader& reader) {
+        LoadStageStates(reader, Stages);
+
+        // stats are empty, when the snapshot is taken before the first tick
+        LoadStageStats(reader, Stats, StatsTime);
+        if (Stats.size() != 0 && Stats.size() != Stages.size()) {
+            throw std::runtime_error("Snapshot has stats for different number of stages");
+        }
+    }
+
+protected:
+    void TickStages(SimTime dt) {
+        if (Stats.size() != Stages.size()) {
+            Stats.resize(Stages.size());
+        }
+
+        StatsTime += dt;
+        for (size_t i = 0; i < Stages.size(); ++i) {
+            auto& stage = Stages[i];
             stage->Tick(dt);
+            Stats[i].TotalEventTime += (SimTime)stage->GetEventCount() * dt;
         }
+    }
 
-        if (Stages.size() <= 2) {
+    void TransferEvents() {
+        if (Stages.size() < 2) {
             return;
         }
 
@@ -144,6 +448,7 @@ public:
 
             while (stage->IsReadyToPopEvent() && nextStage->IsReadyToPushEvent()) {
                 auto event = stage->PopEvent();
+                OnDeparture(i - 1, event);
                 nextStage->PushEvent(event);
             }
         }
@@ -156,87 +461,574 @@ public:
 
             while (stage->IsReadyToPopEvent() && nextStage->IsReadyToPushEvent()) {
                 auto event = stage->PopEvent();
+                OnDeparture(i - 1, event);
                 nextStage->PushEvent(event);
             }
         }
+    }
+
+    void OnDeparture(size_t stageIndex, const Event& event) {
+        auto& stats = Stats[stageIndex];
+        auto sojourn = event.GetStageDuration();
+        ++stats.Departures;
+        stats.TotalSojourn += sojourn;
+        stats.SojournUs.AddTime(sojourn);
+    }
+
+private:
+    void AddItem(ItemBase* stage) {
+        if (!Stages.empty()) {
+            Stages.back()->SetNextStage(stage);
+        }
+        Stages.emplace_back(stage);
+    }
+
+protected:
+    std::deque<ItemPtr> Stages;
+
+    std::vector<StageStats> Stats;
+    SimTime StatsTime = 0;
+};
+
+// called for each event leaving the pipeline. The intended start is the event start,
+// unless the intended rate is set
+using EventFinishedCallback = std::function<void(const Event& event, SimTime intendedStart)>;
+
+// ----------------------------
+// PipeLineClients: clients of the closed pipeline. Each finished event frees a client,
+// which issues a new event: at once or, when the intended rate is set, at the moment
+// it should be issued according to the rate. The latency is measured both from the
+// actual and from the intended start: the former hides the time, when clients were
+// not able to issue events, because the system was slow (coordinated omission).
+//
+// Clients belong to tenants, the tenant is the source of its events. Tenant 0 owns the
+// events initially put into the input queue
+
+class PipeLineClients {
+private:
+    struct Tenant {
+        size_t FreeClients = 0;
+        double IntendedRate = 0;
+        SimTime IntendedInterval = 0;
+        SimTime NextIntendedTs = 0;
+
+        size_t FinishedEvents = 0;
+        size_t TimedOutEvents = 0;
+
+        // timed out events are counted at their deadlines
+        Histogram IntendedDurationsUs = Histogram::HistogramWithUsBuckets();
+
+        void SetIntendedRate(double rps) {
+            IntendedRate = rps;
+            IntendedInterval = rps > 0 ? (SimTime)(Sec / rps) : 0;
+            NextIntendedTs = Now();
+        }
+    };
+
+    struct Deadline {
+        SimTime Ts = 0;
+        SimTime StartTs = 0;
+        size_t TenantId = 0;
+    };
+
+public:
+    PipeLineClients()
+        : IntendedDurationsUs(Histogram::HistogramWithUsBuckets())
+    {
+        Tenants[0];
+    }
+
+    // see ClosedPipeLine::SetEventTimeout
+    void SetEventTimeout(SimTime timeout) {
+        EventTimeout = timeout;
+    }
+
+    SimTime GetEventTimeout() const {
+        return EventTimeout;
+    }
+
+    // events per second for all clients of the tenant together, 0 disables pacing
+    void SetIntendedRate(double rps, size_t tenantId = 0) {
+        Tenants[tenantId].SetIntendedRate(rps);
+    }
+
+    // sum over the tenants
+    double GetIntendedRate() const {
+        double rps = 0;
+        for (const auto& [id, tenant]: Tenants) {
+            rps += tenant.IntendedRate;
+        }
+        return rps;
+    }
+
+    void AddClients(size_t tenantId, size_t clients) {
+        Tenants[tenantId].FreeClients += clients;
+    }
+
+    // the intended start of the event, nothing, when the client has already given up on it
+    std::optional<SimTime> OnEventFinished(const Event& event) {
+        auto id = event.GetId();
+        if (OrphanIds.erase(id)) {
+            return std::nullopt;
+        }
+        auto deadlineIt = Deadlines.find(id);
+        if (deadlineIt != Deadlines.end()) {
+            DeadlineOrder.erase({deadlineIt->second.Ts, id});
+            Deadlines.erase(deadlineIt);
+        }
+
+        auto intendedStart = event.GetStartTime();
+        auto it = IntendedStarts.find(id);
+        if (it != IntendedStarts.end()) {
+            intendedStart = it->second;
+            IntendedStarts.erase(it);
+        }
+
+        auto now = Now();
+        TotalServiceTime += now - event.GetStartTime();
+        TotalIntendedTime += now - intendedStart;
+        IntendedDurationsUs.AddTime(now - intendedStart);
+
+        auto& tenant = Tenants[event.GetSrc()];
+        ++tenant.FinishedEvents;
+        tenant.IntendedDurationsUs.AddTime(now - intendedStart);
+        ++tenant.FreeClients;
+
+        return intendedStart;
+    }
+
+    // cancel(id) cancels the event in the pipeline, returns true, when it won't leave the pipeline.
+    // The timed out event is counted at its deadline, i.e. latencies are censored by the timeout,
+    // otherwise a timeout would look like a latency win. onTimedOut(serviceLatency) is called
+    // to record the latency from the actual start
+    template <typename TCancel, typename TOnTimedOut>
+    void CancelExpiredEvents(TCancel&& cancel, TOnTimedOut&& onTimedOut) {
+        // the timeout might have been changed, so deadlines don't grow with ids
+        auto now = Now();
+        while (!DeadlineOrder.empty() && DeadlineOrder.begin()->first <= now) {
+            auto id = DeadlineOrder.begin()->second;
+            DeadlineOrder.erase(DeadlineOrder.begin());
+
+            auto deadlineIt = Deadlines.find(id);
+            auto deadline = deadlineIt->second;
+            Deadlines.erase(deadlineIt);
+
+            auto intendedStart = deadline.StartTs;
+            auto it = IntendedStarts.find(id);
+            if (it != IntendedStarts.end()) {
+                intendedStart = it->second;
+                IntendedStarts.erase(it);
+            }
+
+            if (!cancel(id)) {
+                OrphanIds.insert(id);
+            }
+            ++TimedOutEvents;
+
+            CensoredServiceTime += deadline.Ts - deadline.StartTs;
+            CensoredIntendedTime += deadline.Ts - intendedStart;
+            IntendedDurationsUs.AddTime(deadline.Ts - intendedStart);
+            onTimedOut(deadline.Ts - deadline.StartTs);
+
+            auto& tenant = Tenants[deadline.TenantId];
+            ++tenant.TimedOutEvents;
+            tenant.IntendedDurationsUs.AddTime(deadline.Ts - intendedStart);
+            ++tenant.FreeClients;
+        }
+    }
+
+    template <typename TQueue>
+    void IssueEvents(TQueue& inputQueue) {
+        auto now = Now();
+        for (auto& [tenantId, tenant]: Tenants) {
+            while (tenant.FreeClients != 0 && inputQueue.IsReadyToPushEvent()) {
+                auto intendedStart = now;
+                if (tenant.IntendedInterval != 0) {
+                    if (tenant.NextIntendedTs > now) {
+                        break;
+                    }
+                    intendedStart = tenant.NextIntendedTs;
+                    tenant.NextIntendedTs += tenant.IntendedInterval;
+                }
+
+                --tenant.FreeClients;
+
+                auto event = Event::NewEvent(tenantId, 0);
+                if (EventTimeout != 0) {
+                    auto deadlineTs = event.GetStartTime() + EventTimeout;
+                    Deadlines.emplace(event.GetId(), Deadline{deadlineTs, event.GetStartTime(), tenantId});
+                    DeadlineOrder.emplace(deadlineTs, event.GetId());
+                }
+                if (intendedStart != event.GetStartTime()) {
+                    IntendedStarts.emplace(event.GetId(), intendedStart);
+                }
+                inputQueue.PushEvent(event);
+            }
+        }
+    }
+
+    size_t GetTimedOutEvents() const {
+        return TimedOutEvents;
+    }
+
+    // intended start latency and timeouts, when they are enabled
+    std::string GetStatsText(size_t finishedEvents) const {
+        std::string text;
+
+        if (GetIntendedRate() != 0) {
+            char intended[256];
+            snprintf(intended, sizeof(intended),
+                "\nIntended rate: %.0f rps, from intended start p50: %d us, p90: %d us, p99: %d us, p100: %d us",
+                GetIntendedRate(), IntendedDurationsUs.GetPercentile(50), IntendedDurationsUs.GetPercentile(90),
+                IntendedDurationsUs.GetPercentile(99), IntendedDurationsUs.GetPercentile(100));
+            text += intended;
+        }
+
+        if (EventTimeout != 0) {
+            char timeouts[128];
+            snprintf(timeouts, sizeof(timeouts), "\nTimeout: %.2f ms, timed out: %ld (%.3f%%), counted at the deadline",
+                (double)EventTimeout / Msec, TimedOutEvents,
+                100.0 * TimedOutEvents / std::max<size_t>(finishedEvents + TimedOutEvents, 1));
+            text += timeouts;
+        }
+
+        return text;
+    }
+
+    // the results of the pipeline, which runs these clients
+    PipeLineResults GetResults(
+        SimTime timePassed,
+        size_t finishedEvents,
+        const Histogram& eventDurationsUs,
+        std::vector<StageResults> stages) const
+    {
+        PipeLineResults results;
+        results.TimePassedS = ToSeconds(timePassed);
+        results.FinishedEvents = finishedEvents;
+        results.TimedOutEvents = TimedOutEvents;
+        results.ThroughputRps = timePassed ? finishedEvents / results.TimePassedS : 0;
+        results.IntendedRateRps = GetIntendedRate();
+
+        // timed out events are counted at their deadlines, as in the histograms
+        std::optional<double> meanServiceUs;
+        std::optional<double> meanIntendedUs;
+        if (auto count = finishedEvents + TimedOutEvents) {
+            meanServiceUs = (double)(TotalServiceTime + CensoredServiceTime) / count / Usec;
+            meanIntendedUs = (double)(TotalIntendedTime + CensoredIntendedTime) / count / Usec;
+        }
+        results.ServiceLatencyUs = LatencyResults::FromHistogram(eventDurationsUs, meanServiceUs);
+        results.IntendedStartLatencyUs = LatencyResults::FromHistogram(IntendedDurationsUs, meanIntendedUs);
+
+        results.Tenants = GetTenantResults(timePassed);
+        results.Stages = std::move(stages);
+        for (const auto& stage: results.Stages) {
+            results.LittleLaw.AvgEvents += stage.LittleLaw.AvgEvents;
+        }
+        if (timePassed) {
+            results.LittleLaw.ThroughputTimesLatency = (double)TotalServiceTime / timePassed;
+        }
+
+        return results;
+    }
+
+    const Histogram& GetIntendedDurationsUs() const {
+        return IntendedDurationsUs;
+    }
+
+    SimTime GetTotalServiceTime() const {
+        return TotalServiceTime;
+    }
+
+    SimTime GetTotalIntendedTime() const {
+        return TotalIntendedTime;
+    }
+
+    // of the timed out events, till their deadlines
+    SimTime GetCensoredServiceTime() const {
+        return CensoredServiceTime;
+    }
+
+    SimTime GetCensoredIntendedTime() const {
+        return CensoredIntendedTime;
+    }
+
+    // tenants, which have clients or have finished events
+    std::vector<TenantResults> GetTenantResults(SimTime timePassed) const {
+        std::vector<TenantResults> results;
+        for (const auto& [id, tenant]: Tenants) {
+            if (tenant.FinishedEvents == 0 && tenant.TimedOutEvents == 0 && tenant.FreeClients == 0) {
+                continue;
+            }
+
+            TenantResults tenantResults;
+            tenantResults.Id = id;
+            tenantResults.FinishedEvents = tenant.FinishedEvents;
+            tenantResults.TimedOutEvents = tenant.TimedOutEvents;
+            tenantResults.ThroughputRps = timePassed ? tenant.FinishedEvents / ToSeconds(timePassed) : 0;
+            tenantResults.IntendedRateRps = tenant.IntendedRate;
+            tenantResults.IntendedStartLatencyUs = LatencyResults::FromHistogram(tenant.IntendedDurationsUs);
+            results.push_back(std::move(tenantResults));
+        }
+        return results;
+    }
+
+    // nothing, which would be lost, when the clients aren't supported (see StaticPipeLine)
+    bool HasEventsInFlight() const {
+        for (const auto& [id, tenant]: Tenants) {
+            if (tenant.FreeClients != 0) {
+                return true;
+            }
+        }
+        return !Deadlines.empty() || !OrphanIds.empty() || !IntendedStarts.empty();
+    }
+
+    void Save(SnapshotWriter& writer) const {
+        writer.Write(Tenants.size());
+        for (const auto& [id, tenant]: Tenants) {
+            writer.Write(id);
+            writer.Write(tenant.FreeClients);
+            writer.Write(tenant.NextIntendedTs);
+            writer.Write(tenant.FinishedEvents);
+            writer.Write(tenant.TimedOutEvents);
+            tenant.IntendedDurationsUs.Save(writer);
+        }
+
+        writer.Write(Deadlines.size());
+        for (const auto& [id, deadline]: Deadlines) {
+            writer.Write(id);
+            writer.Write(deadline.Ts);
+            writer.Write(deadline.StartTs);
+            writer.Write(deadline.TenantId);
+        }
+        writer.Write(OrphanIds.size());
+        for (auto id: OrphanIds) {
+            writer.Write(id);
+        }
+        writer.Write(IntendedStarts.size());
+        for (const auto& [id, intendedStart]: IntendedStarts) {
+            writer.Write(id);
+            writer.Write(intendedStart);
+        }
+
+        writer.Write(TimedOutEvents);
+        IntendedDurationsUs.Save(writer);
+        writer.Write(TotalServiceTime);
+        writer.Write(TotalIntendedTime);
+        writer.Write(CensoredServiceTime);
+        writer.Write(CensoredIntendedTime);
+    }
+
+    // intended rates are the config, thus they are kept
+    void Load(SnapshotReader& reader) {
+        for (auto& [id, tenant]: Tenants) {
+            tenant.FreeClients = 0;
+            tenant.FinishedEvents = 0;
+            tenant.TimedOutEvents = 0;
+            tenant.IntendedDurationsUs = Histogram::HistogramWithUsBuckets();
+        }
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto& tenant = Tenants[reader.Read<size_t>()];
+            reader.Read(tenant.FreeClients);
+            reader.Read(tenant.NextIntendedTs);
+            reader.Read(tenant.FinishedEvents);
+            reader.Read(tenant.TimedOutEvents);
+            tenant.IntendedDurationsUs.Load(reader);
+        }
+
+        Deadlines.clear();
+        DeadlineOrder.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto id = reader.Read<size_t>();
+            Deadline deadline;
+            reader.Read(deadline.Ts);
+            reader.Read(deadline.StartTs);
+            reader.Read(deadline.TenantId);
+            Deadlines.emplace(id, deadline);
+            DeadlineOrder.emplace(deadline.Ts, id);
+        }
+        OrphanIds.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            OrphanIds.insert(reader.Read<size_t>());
+        }
+        IntendedStarts.clear();
+        size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto id = reader.Read<size_t>();
+            IntendedStarts.emplace(id, reader.Read<SimTime>());
+        }
+
+        reader.Read(TimedOutEvents);
+        IntendedDurationsUs.Load(reader);
+        reader.Read(TotalServiceTime);
+        reader.Read(TotalIntendedTime);
+        reader.Read(CensoredServiceTime);
+        reader.Read(CensoredIntendedTime);
+    }
+
+private:
+    SimTime EventTimeout = 0;
+
+    // by id, which is the source of the tenant's events
+    std::map<size_t, Tenant> Tenants;
+
+    std::map<size_t, Deadline> Deadlines;     // events in flight, which have a deadline
+    std::set<size_t> OrphanIds;               // cancelled events, which will still leave the pipeline
+    std::map<size_t, SimTime> IntendedStarts; // events issued later than intended
+
+    // the same events as Deadlines, by the deadline and then by id
+    std::set<std::pair<SimTime, size_t>> DeadlineOrder;
+
+    size_t TimedOutEvents = 0;
+    Histogram IntendedDurationsUs; // timed out events are counted at their deadlines
+    SimTime TotalServiceTime = 0;  // of the finished events
+    SimTime TotalIntendedTime = 0;
+    SimTime CensoredServiceTime = 0;
+    SimTime CensoredIntendedTime = 0;
+};
+
+// ----------------------------
+// ClosedPipeLine
+
+// assumes, that the first stage is the input queue. Finished events are pushed back to the input queue
+class ClosedPipeLine : public StageChain {
+public:
+    ClosedPipeLine(Sprite sprite)
+        : EventDurationsUs(Histogram::HistogramWithUsBuckets())
+        , _Sprite(sprite)
+    {
+    }
+
+    void Tick(SimTime dt) {
+        TotalTimePassed += dt;
+
+        TickStages(dt);
+
+        if (Stages.size() <= 2) {
+            return;
+        }
+
+        TransferEvents();
 
         auto& inputQueue = Stages.front();
         auto& lastStage = Stages.back();
 
-        while (lastStage->IsReadyToPopEvent() && inputQueue->IsReadyToPushEvent()) {
+        while (lastStage->IsReadyToPopEvent()) {
             auto event = lastStage->PopEvent();
+            OnDeparture(Stages.size() - 1, event);
+
+            auto intendedStart = Clients.OnEventFinished(event);
+            if (!intendedStart) {
+                continue;
+            }
 
             ++TotalFinishedEvents;
-            EventDurationsUs.AddDuration((int)(event.GetDuration() * 1000000));
+            EventDurationsUs.AddTime(event.GetDuration());
 
-            auto newEvent = Event::NewEvent();
-            inputQueue->PushEvent(newEvent);
+            for (auto& callback: EventFinishedCallbacks) {
+                callback(event, *intendedStart);
+            }
         }
 
-        AvgRPS = (size_t)(TotalFinishedEvents / TotalTimePassed);
+        Clients.CancelExpiredEvents(
+            [this](size_t id) { return CancelEvent(id); },
+            [this](SimTime latency) { EventDurationsUs.AddTime(latency); });
+        Clients.IssueEvents(*inputQueue);
+
+        AvgRPS = (size_t)(TotalFinishedEvents * Sec / TotalTimePassed);
     }
 
-public:
-    void Draw() {
-        auto stageCount = Stages.size();
-        auto width = _Sprite.Width();
-        auto height = _Sprite.Height();
+    // Snapshot contains the global time, the event counter, the state of all stages
+    // and the pipeline stats. It can be loaded into a pipeline with the same stages,
+    // but with a different config.
+    void SaveSnapshot(SnapshotWriter& writer) const {
+        writer.Write(PipeLineSnapshotMagic);
+        writer.Write(Now());
+        writer.Write(Event::GetEventCounter());
 
-        const Si32 spacing = 5;
-        const Si32 widthWithoutSpacing = width - spacing * 2;
-        const Si32 heightWithoutSpacing = height - spacing * 2;
-        const Si32 footerHeight = 100;
+        SaveStages(writer);
 
-        size_t space_between_stages = 50;
-        Si32 stage_width = ((widthWithoutSpacing - space_between_stages * (stageCount - 1))) / stageCount;
-        Si32 stage_height = heightWithoutSpacing - footerHeight;
+        writer.Write(TotalFinishedEvents);
+        writer.Write(TotalTimePassed);
+        EventDurationsUs.Save(writer);
+        writer.Write(AvgRPS);
 
-        for (size_t i = 0; i < stageCount; ++i) {
-            auto& stage = Stages[i];
-            Si32 x = i * (stage_width + space_between_stages) + spacing;
-            Si32 y = spacing + footerHeight;
-            Sprite stageSprite;
-            stageSprite.Reference(_Sprite, x, y, stage_width, stage_height);
-            stage->Draw(stageSprite);
-
-            if (i != 0) {
-                Si32 prevX = x - space_between_stages;
-                Si32 middleY = y + stage_height / 2;
-                Vec2F src(prevX, middleY);
-                Vec2F dst(x, middleY);
-                DrawArrow(_Sprite, src, dst, 5, 20, 10, Rgba(0, 0, 0));
-            }
+        Clients.Save(writer);
+    }
+
+    void LoadSnapshot(SnapshotReader& reader) {
+        if (reader.Read<uint64_t>() != PipeLineSnapshotMagic) {
+            throw std::runtime_error("Not a pipeline snapshot");
         }
 
-        char text[512];
-        snprintf(text, sizeof(text),
-            "TimePassed: %.2f s, Events: %ld, AvgRPS: %ld\np10: %d us, p50: %d us, p90: %d us, p99: %d us, p100: %d us",
-            TotalTimePassed,
-            TotalFinishedEvents,
-            AvgRPS,
-            EventDurationsUs.GetPercentile(10),
-            EventDurationsUs.GetPercentile(50),
-            EventDurationsUs.GetPercentile(90),
-            EventDurationsUs.GetPercentile(99),
-            EventDurationsUs.GetPercentile(100)
-        );
-        DrawRectangle(
-            _Sprite,
-            arctic::Vec2Si32(spacing, spacing + footerHeight * 2.8),
-            arctic::Vec2Si32(width - spacing, footerHeight * 2.8 + 100),
-            YDBColorDarkViolet);
-        GetFont().Draw(_Sprite, text, spacing * 2, footerHeight * 2.8 + spacing + 5);
+        SetTime(reader.Read<SimTime>());
+        Event::SetEventCounter(reader.Read<size_t>());
+
+        LoadStages(reader);
+
+        reader.Read(TotalFinishedEvents);
+        reader.Read(TotalTimePassed);
+        EventDurationsUs.Load(reader);
+        reader.Read(AvgRPS);
+
+        Clients.Load(reader);
     }
 
-private:
-    std::deque<ItemPtr> Stages;
+    std::string GetStatsText() {
+        return FormatLatencyStats(TotalTimePassed, TotalFinishedEvents, AvgRPS, EventDurationsUs)
+            + Clients.GetStatsText(TotalFinishedEvents);
+    }
+
+    PipeLineResults GetResults() const {
+        return Clients.GetResults(TotalTimePassed, TotalFinishedEvents, EventDurationsUs, GetStageResults());
+    }
 
+    // Events, which are not finished within the timeout since their start, are cancelled:
+    // the client gives up and issues another event. Events issued before the timeout
+    // is set don't have a deadline, events issued before it is changed keep their deadlines.
+    // 0 disables timeouts
+    void SetEventTimeout(SimTime timeout) {
+        Clients.SetEventTimeout(timeout);
+    }
+
+    // clients issue events not faster than the rate, see PipeLineClients. 0 disables pacing
+    void SetIntendedRate(double rps) {
+        Clients.SetIntendedRate(rps);
+    }
+
+    // clients of another tenant, their events have the tenant id as the source
+    void AddTenantClients(size_t tenantId, size_t clients, double intendedRate = 0) {
+        Clients.AddClients(tenantId, clients);
+        Clients.SetIntendedRate(intendedRate, tenantId);
+    }
+
+    size_t GetTimedOutEvents() const {
+        return Clients.GetTimedOutEvents();
+    }
+
+    // called for each event leaving the pipeline, e.g. to collect additional stats
+    void AddEventFinishedCallback(EventFinishedCallback callback) {
+        EventFinishedCallbacks.push_back(std::move(callback));
+    }
+
+public:
+    void Draw() {
+        DrawStages(_Sprite, Stages, GetStatsText());
+    }
+
+private:
     size_t TotalFinishedEvents = 0;
-    double TotalTimePassed = 0;
+    SimTime TotalTimePassed = 0;
 
     Histogram EventDurationsUs;
     size_t AvgRPS = 0;
 
+    std::vector<EventFinishedCallback> EventFinishedCallbacks;
+
+    PipeLineClients Clients;
+
 private:
     Sprite _Sprite;
 };
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Compact binary snapshot of the simulation state: stages serialize their state
+// (not the config) into SnapshotWriter and restore it from SnapshotReader.
+// A snapshot can be restored into a pipeline with the same topology, but
+// a different config, e.g. a slower NVMe.
+
+namespace queue_sim {
+
+// e.g. mt19937::result_type is 64 bit, but all its words fit into 32 bit
+template <typename TEngine>
+using RandomEngineWord = std::conditional_t<(TEngine::max() <= UINT32_MAX), uint32_t, uint64_t>;
+
+// ----------------------------
+// SnapshotWriter
+
+class SnapshotWriter {
+public:
+    template <typename T>
+    void Write(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable types can be written");
+        Data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void WriteString(const std::string& value) {
+        Write(value.size());
+        Data.append(value);
+    }
+
+    // the only portable access to the engine state is its text representation,
+    // which is packed into binary words
+    template <typename TEngine>
+    void WriteRandomEngine(const TEngine& engine) {
+        std::ostringstream ss;
+        ss << engine;
+
+        std::vector<RandomEngineWord<TEngine>> words;
+        std::istringstream in(ss.str());
+        uint64_t word;
+        while (in >> word) {
+            words.push_back((RandomEngineWord<TEngine>)word);
+        }
+
+        Write(words.size());
+        for (auto w: words) {
+            Write(w);
+        }
+    }
+
+    const std::string& GetData() const {
+        return Data;
+    }
+
+    void SaveToFile(const std::string& path) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(Data.data(), Data.size());
+        if (!file) {
+            throw std::runtime_error("Failed to write snapshot to " + path);
+        }
+    }
+
+private:
+    std::string Data;
+};
+
+// ----------------------------
+// SnapshotReader
+
+class SnapshotReader {
+public:
+    explicit SnapshotReader(std::string data)
+        : Data(std::move(data))
+    {
+    }
+
+    static SnapshotReader FromFile(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("Failed to read snapshot from " + path);
+        }
+
+        std::ostringstream ss;
+        ss << file.rdbuf();
+        return SnapshotReader(ss.str());
+    }
+
+    template <typename T>
+    T Read() {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable types can be read");
+        if (Data.size() - Offset < sizeof(T)) {
+            throw std::runtime_error("Snapshot is truncated");
+        }
+
+        T value;
+        memcpy(&value, Data.data() + Offset, sizeof(T));
+        Offset += sizeof(T);
+        return value;
+    }
+
+    template <typename T>
+    void Read(T& value) {
+        value = Read<T>();
+    }
+
+    std::string ReadString() {
+        auto size = Read<size_t>();
+        if (Data.size() - Offset < size) {
+            throw std::runtime_error("Snapshot is truncated");
+        }
+
+        std::string value = Data.substr(Offset, size);
+        Offset += size;
+        return value;
+    }
+
+    template <typename TEngine>
+    void ReadRandomEngine(TEngine& engine) {
+        std::ostringstream ss;
+        auto size = Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            ss << (uint64_t)Read<RandomEngineWord<TEngine>>() << ' ';
+        }
+
+        std::istringstream in(ss.str());
+        in >> engine;
+        if (!in) {
+            throw std::runtime_error("Failed to restore random engine state");
+        }
+    }
+
+    bool IsEnd() const {
+        return Offset == Data.size();
+    }
+
+private:
+    std::string Data;
+    size_t Offset = 0;
+};
+
+// ----------------------------
+// ForkVariants: runs each variant in a child process forked from the current state.
+// Forked processes share memory copy-on-write, so the warm up is paid once,
+// and the variants run in parallel. Blocks until all variants finish, throws
+// when any of them has failed (an exception, a crash or a non-zero exit).
+// Note, that all variants get the same random streams (common random numbers).
+
+// returns the number of failed children
+inline size_t WaitChildren(const std::vector<pid_t>& children) {
+    size_t failed = 0;
+    for (size_t variant = 0; variant < children.size(); ++variant) {
+        int status = 0;
+        pid_t result;
+        do {
+            result = waitpid(children[variant], &status, 0);
+        } while (result < 0 && errno == EINTR);
+
+        if (result < 0) {
+            fprintf(stderr, "Variant %zu: failed to wait: %s\n", variant, strerror(errno));
+            ++failed;
+        } else if (WIFSIGNALED(status)) {
+            fprintf(stderr, "Variant %zu killed by signal %d\n", variant, WTERMSIG(status));
+            ++failed;
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Variant %zu exited with code %d\n", variant, WEXITSTATUS(status));
+            ++failed;
+        }
+    }
+    return failed;
+}
+
+inline void ForkVariants(size_t variantCount, const std::function<void(size_t variant)>& runVariant) {
+    // otherwise buffered output is duplicated by children
+    fflush(stdout);
+    fflush(stderr);
+
+    std::vector<pid_t> children;
+    for (size_t variant = 0; variant < variantCount; ++variant) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            // the variants forked before must not be left running and unreaped
+            int forkError = errno;
+            WaitChildren(children);
+            throw std::runtime_error(std::string("Failed to fork variant: ") + strerror(forkError));
+        }
+
+        if (pid == 0) {
+            int exitCode = 0;
+            try {
+                runVariant(variant);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Variant %zu failed: %s\n", variant, e.what());
+                exitCode = 1;
+            } catch (...) {
+                fprintf(stderr, "Variant %zu failed\n", variant);
+                exitCode = 1;
+            }
+            fflush(stdout);
+            fflush(stderr);
+            _exit(exitCode);
+        }
+
+        children.push_back(pid);
+    }
+
+    if (size_t failed = WaitChildren(children)) {
+        throw std::runtime_error(std::to_string(failed) + " of " + std::to_string(variantCount) + " variants failed");
+    }
+}
+
+} // namespace queue_sim
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "engine/easy.h"
+#include "engine/easy_drawing.h"
+#include "engine/easy_sprite.h"
+
+#include "common.h"
+#include "simple_pipeline.h"
+
+// The same closed pipeline as ClosedPipeLine, but the stages are known at compile
+// time: they are stored by value in a tuple, and the event transfer is unrolled.
+// Concrete stage classes are final, so the calls are not virtual and can be inlined.
+// Use ClosedPipeLine, when the model is configured at runtime.
+
+namespace queue_sim {
+
+// ----------------------------
+// StaticPipeLine
+
+// assumes, that the first stage is the input queue. Clients, stage stats and results
+// are the same as of ClosedPipeLine
+template <typename... TStages>
+class StaticPipeLine {
+private:
+    static constexpr size_t StageCount = sizeof...(TStages);
+    static_assert(StageCount > 2, "Pipeline must have input queue, last stage and something between");
+
+public:
+    StaticPipeLine(Sprite sprite, TStages&&... stages)
+        : Stages(std::move(stages)...)
+        , Stats(StageCount)
+        , EventDurationsUs(Histogram::HistogramWithUsBuckets())
+        , _Sprite(sprite)
+    {
+        SetNextStages(std::make_index_sequence<StageCount - 1>());
+    }
+
+    // stages know their neighbours by address
+    StaticPipeLine(const StaticPipeLine& other) = delete;
+    StaticPipeLine(StaticPipeLine&& other) = delete;
+
+    template <size_t Index>
+    auto& GetStage() {
+        return std::get<Index>(Stages);
+    }
+
+    constexpr size_t GetStageCount() const {
+        return StageCount;
+    }
+
+    void Tick(SimTime dt) {
+        TotalTimePassed += dt;
+        StatsTime += dt;
+
+        TickStages(dt, std::make_index_sequence<StageCount>());
+
+        // see StageChain::TransferEvents why there are two passes
+        TransferEvents(std::make_index_sequence<StageCount - 1>());
+        TransferEvents(std::make_index_sequence<StageCount - 1>());
+
+        auto& inputQueue = std::get<0>(Stages);
+        auto& lastStage = std::get<StageCount - 1>(Stages);
+
+        while (lastStage.IsReadyToPopEvent()) {
+            auto event = lastStage.PopEvent();
+            OnDeparture(StageCount - 1, event);
+
+            auto intendedStart = Clients.OnEventFinished(event);
+            if (!intendedStart) {
+                continue;
+            }
+
+            ++TotalFinishedEvents;
+            EventDurationsUs.AddTime(event.GetDuration());
+
+            for (auto& callback: EventFinishedCallbacks) {
+                callback(event, *intendedStart);
+            }
+        }
+
+        Clients.CancelExpiredEvents(
+            [this](size_t id) { return CancelEvent(id); },
+            [this](SimTime latency) { EventDurationsUs.AddTime(latency); });
+        Clients.IssueEvents(inputQueue);
+
+        AvgRPS = (size_t)(TotalFinishedEvents * Sec / TotalTimePassed);
+    }
+
+    // see ClosedPipeLine
+    void SetEventTimeout(SimTime timeout) {
+        Clients.SetEventTimeout(timeout);
+    }
+
+    void SetIntendedRate(double rps) {
+        Clients.SetIntendedRate(rps);
+    }
+
+    void AddTenantClients(size_t tenantId, size_t clients, double intendedRate = 0) {
+        Clients.AddClients(tenantId, clients);
+        Clients.SetIntendedRate(intendedRate, tenantId);
+    }
+
+    size_t GetTimedOutEvents() const {
+        return Clients.GetTimedOutEvents();
+    }
+
+    void AddEventFinishedCallback(EventFinishedCallback callback) {
+        EventFinishedCallbacks.push_back(std::move(callback));
+    }
+
+    // the same format as ClosedPipeLine::SaveSnapshot, so snapshots can be
+    // loaded by the dynamic pipeline with the same stages and vice versa
+    void SaveSnapshot(SnapshotWriter& writer) const {
+        writer.Write(PipeLineSnapshotMagic);
+        writer.Write(Now());
+        writer.Write(Event::GetEventCounter());
+
+        SaveStageStates(writer, GetStagePointers());
+        SaveStageStats(writer, Stats, StatsTime);
+
+        writer.Write(TotalFinishedEvents);
+        writer.Write(TotalTimePassed);
+        EventDurationsUs.Save(writer);
+        writer.Write(AvgRPS);
+
+        Clients.Save(writer);
+    }
+
+    void LoadSnapshot(SnapshotReader& reader) {
+        if (reader.Read<uint64_t>() != PipeLineSnapshotMagic) {
+            throw std::runtime_error("Not a pipeline snapshot");
+        }
+
+        SetTime(reader.Read<SimTime>());
+        Event::SetEventCounter(reader.Read<size_t>());
+
+        auto stages = GetStagePointers();
+        LoadStageStates(reader, stages);
+
+        // stats are empty, when the snapshot is taken before the first tick
+        LoadStageStats(reader, Stats, StatsTime);
+        if (Stats.empty()) {
+            Stats.resize(StageCount);
+        } else if (Stats.size() != StageCount) {
+            throw std::runtime_error("Snapshot has stats for different number of stages");
+        }
+
+        reader.Read(TotalFinishedEvents);
+        reader.Read(TotalTimePassed);
+        EventDurationsUs.Load(reader);
+        reader.Read(AvgRPS);
+
+        Clients.Load(reader);
+    }
+
+    std::string GetStatsText() {
+        return FormatLatencyStats(TotalTimePassed, TotalFinishedEvents, AvgRPS, EventDurationsUs)
+            + Clients.GetStatsText(TotalFinishedEvents);
+    }
+
+    PipeLineResults GetResults() const {
+        auto stages = GetStageResults(GetStagePointers(), Stats, StatsTime);
+        return Clients.GetResults(TotalTimePassed, TotalFinishedEvents, EventDurationsUs, std::move(stages));
+    }
+
+public:
+    void Draw() {
+        DrawStages(_Sprite, GetStagePointers(), GetStatsText());
+    }
+
+private:
+    template <size_t... Indices>
+    void SetNextStages(std::index_sequence<Indices...>) {
+        (std::get<Indices>(Stages).SetNextStage(&std::get<Indices + 1>(Stages)), ...);
+    }
+
+    template <size_t... Indices>
+    void TickStages(SimTime dt, std::index_sequence<Indices...>) {
+        (TickStage<Indices>(dt), ...);
+    }
+
+    template <size_t Index>
+    void TickStage(SimTime dt) {
+        auto& stage = std::get<Index>(Stages);
+        stage.Tick(dt);
+        Stats[Index].TotalEventTime += (SimTime)stage.GetEventCount() * dt;
+    }
+
+    // stage I - 1 -> stage I, starting from the end of the pipeline
+    template <size_t... Indices>
+    void TransferEvents(std::index_sequence<Indices...>) {
+        (TransferEvents<StageCount - 1 - Indices>(), ...);
+    }
+
+    template <size_t Index>
+    void TransferEvents() {
+        auto& stage = std::get<Index - 1>(Stages);
+        auto& nextStage = std::get<Index>(Stages);
+
+        while (stage.IsReadyToPopEvent() && nextStage.IsReadyToPushEvent()) {
+            auto event = stage.PopEvent();
+            OnDeparture(Index - 1, event);
+            nextStage.PushEvent(event);
+        }
+    }
+
+    void OnDeparture(size_t stageIndex, const Event& event) {
+        auto& stats = Stats[stageIndex];
+        auto sojourn = event.GetStageDuration();
+        ++stats.Departures;
+        stats.TotalSojourn += sojourn;
+        stats.SojournUs.AddTime(sojourn);
+    }
+
+    bool CancelEvent(size_t id) {
+        return std::apply([id](auto&... stage) {
+            bool cancelled = false;
+            ((cancelled = stage.CancelEvent(id) || cancelled), ...);
+            return cancelled;
+        }, Stages);
+    }
+
+    // the cold path (drawing, snapshots) goes through ItemBase
+    std::array<ItemBase*, StageCount> GetStagePointers() {
+        return std::apply([](auto&... stage) {
+            return std::array<ItemBase*, StageCount>{&stage...};
+        }, Stages);
+    }
+
+    std::array<const ItemBase*, StageCount> GetStagePointers() const {
+        return std::apply([](const auto&... stage) {
+            return std::array<const ItemBase*, StageCount>{&stage...};
+        }, Stages);
+    }
+
+private:
+    std::tuple<TStages...> Stages;
+
+    std::vector<StageStats> Stats;
+    SimTime StatsTime = 0;
+
+    size_t TotalFinishedEvents = 0;
+    SimTime TotalTimePassed = 0;
+
+    Histogram EventDurationsUs;
+    size_t AvgRPS = 0;
+
+    std::vector<EventFinishedCallback> EventFinishedCallbacks;
+
+    PipeLineClients Clients;
+
+private:
+    Sprite _Sprite;
+};
+
+} // namespace queue_sim
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <deque>
+#include <limits>
+
+#include "engine/easy.h"
+#include "engine/easy_drawing.h"
+#include "engine/easy_sprite.h"
+
+#include "common.h"
+
+// Queue between two threads, which charges the cost of passing events
+// from the producer thread to the consumer thread: futex wakeups, context
+// switches and cache migration. The consumer is the next stage: it starts
+// spinning (or goes to sleep), when it has nothing to do, i.e. both the queue
+// and the consumer are empty.
+
+namespace queue_sim {
+
+// ----------------------------
+// ThreadHandoffConfig
+
+struct ThreadHandoffConfig {
+    static constexpr SimTime NeverSleep = std::numeric_limits<SimTime>::max();
+
+    // consumer was sleeping: time to wake it up and to switch to it
+    SimTime WakeupLatency = 5 * Usec;
+    SimTime ContextSwitchTime = 2 * Usec;
+
+    // charged for every event: the consumer gets cold cache lines
+    SimTime CacheMigrationTime = 0;
+
+    // after taking the last event the consumer spins this long before sleeping,
+    // use NeverSleep to model busy polling
+    SimTime SpinWindow = 0;
+
+    // while spinning the consumer checks the queue once per interval, 0 means continuously
+    SimTime PollInterval = 0;
+
+    // producer wakes the sleeping consumer once WakeupBatch events are pending
+    // or the first pending event waits for WakeupBatchTimeout
+    size_t WakeupBatch = 1;
+    SimTime WakeupBatchTimeout = 0;
+};
+
+// ----------------------------
+// ThreadHandoff
+
+class ThreadHandoff final : public ItemBase {
+private:
+    struct HandoffEvent {
+        Event _Event;
+        SimTime ReadyTs;
+    };
+
+    static constexpr SimTime NotReadyTs = std::numeric_limits<SimTime>::max();
+
+public:
+    ThreadHandoff(const char* name, ThreadHandoffConfig config)
+        : Name(name)
+        , Config(config)
+        , HandoffTimeUs(Histogram::HistogramWithUsBuckets())
+        , ServiceTimeUs(Histogram::HistogramWithUsBuckets())
+    {
+        if (Config.WakeupBatch == 0) {
+            throw std::runtime_error("Wakeup batch must be positive");
+        }
+    }
+
+    const char* GetName() const override {
+        return Name;
+    }
+
+    void SetNextStage(const ItemBase* stage) override {
+        Consumer = stage;
+    }
+
+    void Tick(SimTime) override {
+        // consumer has finished the events taken before and becomes idle
+        if (IsConsumerAwake && Events.empty() && Consumer && Consumer->GetEventCount() == 0) {
+            IsConsumerAwake = false;
+            IdleStartTs = Now();
+        }
+
+        if (PendingEvents > 0 && Now() - PendingSinceTs >= Config.WakeupBatchTimeout) {
+            WakeupConsumer();
+        }
+    }
+
+    bool IsReadyToPushEvent() const override {
+        // the queue is infinite
+        return true;
+    }
+
+    void PushEvent(Event event) override {
+        event.StartStage();
+
+        auto now = Now();
+        if (IsConsumerAwake) {
+            auto readyTs = std::max(now, WakeupFinishTs) + Config.CacheMigrationTime;
+            Events.push_back({event, readyTs});
+            return;
+        }
+
+        auto idleTime = now - IdleStartTs;
+        if (idleTime <= Config.SpinWindow) {
+            // consumer is spinning and will notice the event at the next poll
+            SimTime pollDelay = 0;
+            if (Config.PollInterval > 0) {
+                pollDelay = Config.PollInterval - idleTime % Config.PollInterval;
+            }
+
+            ++SpinHits;
+            IsConsumerAwake = true;
+            WakeupFinishTs = now + pollDelay;
+            Events.push_back({event, WakeupFinishTs + Config.CacheMigrationTime});
+            return;
+        }
+
+        // consumer sleeps, producer might delay the wakeup to batch events
+        if (PendingEvents == 0) {
+            PendingSinceTs = now;
+        }
+
+        ++PendingEvents;
+        Events.push_back({event, NotReadyTs});
+
+        if (PendingEvents >= Config.WakeupBatch) {
+            WakeupConsumer();
+        }
+    }
+
+    bool IsReadyToPopEvent() const override {
+        return !Events.empty() && Events.front().ReadyTs <= Now() && !Fault.BlocksPop();
+    }
+
+    Event PopEvent() override {
+        if (!IsReadyToPopEvent()) {
+            throw std::runtime_error("No events ready");
+        }
+
+        Event event = Events.front()._Event;
+        HandoffTimeUs.AddTime(event.GetStageDuration());
+        ServiceTimeUs.AddTime(Events.front().ReadyTs - event.GetStageStartTime());
+
+        Events.pop_front();
+
+        if (Events.empty() && !Consumer) {
+            // without the known consumer: it took everything and starts spinning (or goes to sleep)
+            IsConsumerAwake = false;
+            IdleStartTs = Now();
+        }
+
+        return event;
+    }
+
+    size_t GetEventCount() const override {
+        return Events.size();
+    }
+
+    // the cost of the handoff: wakeup, context switch and cache migration. Unlike
+    // the handoff time, without the wait for the consumer to take the event
+    const Histogram* GetServiceTimeUs() const override {
+        return &ServiceTimeUs;
+    }
+
+    void SaveState(SnapshotWriter& writer) const override {
+        writer.Write(Events.size());
+        for (const auto& handoffEvent: Events) {
+            handoffEvent._Event.Save(writer);
+            writer.Write(handoffEvent.ReadyTs);
+        }
+        HandoffTimeUs.Save(writer);
+        ServiceTimeUs.Save(writer);
+
+        writer.Write(IsConsumerAwake);
+        writer.Write(IdleStartTs);
+        writer.Write(WakeupFinishTs);
+        writer.Write(PendingEvents);
+        writer.Write(PendingSinceTs);
+        writer.Write(Wakeups);
+        writer.Write(SpinHits);
+    }
+
+    void LoadState(SnapshotReader& reader) override {
+        Events.clear();
+        auto size = reader.Read<size_t>();
+        for (size_t i = 0; i < size; ++i) {
+            auto event = Event::Load(reader);
+            Events.push_back({event, reader.Read<SimTime>()});
+        }
+        HandoffTimeUs.Load(reader);
+        ServiceTimeUs.Load(reader);
+
+        reader.Read(IsConsumerAwake);
+        reader.Read(IdleStartTs);
+        reader.Read(WakeupFinishTs);
+        reader.Read(PendingEvents);
+        reader.Read(PendingSinceTs);
+        reader.Read(Wakeups);
+        reader.Read(SpinHits);
+    }
+
+    size_t GetWakeups() const {
+        return Wakeups;
+    }
+
+    size_t GetSpinHits() const {
+        return SpinHits;
+    }
+
+public:
+    void Draw(arctic::Sprite toSprite) override {
+        auto width = toSprite.Width();
+        auto height = toSprite.Height();
+
+        auto rWidth = width;
+        auto rHeight = width / 2;
+        auto yPos = height / 2 - rHeight / 2;
+
+        arctic::Vec2Si32 bottomLeft(0, yPos);
+        arctic::Vec2Si32 topRight(rWidth, yPos + rHeight);
+        DrawRectangle(toSprite, bottomLeft, topRight, YDBColorQueue);
+
+        arctic::Vec2Si32 bottomLeftCut(0, yPos + 5);
+        arctic::Vec2Si32 topRightCut(10, yPos + rHeight - 5);
+        DrawRectangle(toSprite, bottomLeftCut, topRightCut, BackgroundColor);
+
+        char text[256];
+        auto queueLengthS = NumToStrWithSuffix(Events.size());
+        auto wakeupsS = NumToStrWithSuffix(Wakeups);
+        auto spinHitsS = NumToStrWithSuffix(SpinHits);
+
+        snprintf(text, sizeof(text), "%s: %s\np90: %d us\nWakeups: %s\nSpins: %s",
+                 Name, queueLengthS.c_str(), HandoffTimeUs.GetPercentile(90),
+                 wakeupsS.c_str(), spinHitsS.c_str());
+        GetFont().Draw(toSprite, text, 15, yPos + rHeight / 2 - 60);
+    }
+
+private:
+    void WakeupConsumer() {
+        ++Wakeups;
+        IsConsumerAwake = true;
+        WakeupFinishTs = Now() + Config.WakeupLatency + Config.ContextSwitchTime;
+
+        // pending events are always at the tail
+        for (auto it = Events.rbegin(); it != Events.rend() && PendingEvents > 0; ++it, --PendingEvents) {
+            it->ReadyTs = WakeupFinishTs + Config.CacheMigrationTime;
+        }
+    }
+
+private:
+    const char* Name;
+    ThreadHandoffConfig Config;
+    const ItemBase* Consumer = nullptr;
+
+    std::deque<HandoffEvent> Events;
+    Histogram HandoffTimeUs;
+    Histogram ServiceTimeUs;
+
+    bool IsConsumerAwake = false;
+    SimTime IdleStartTs = 0;
+    SimTime WakeupFinishTs = 0;
+
+    size_t PendingEvents = 0;
+    SimTime PendingSinceTs = 0;
+
+    size_t Wakeups = 0;
+    size_t SpinHits = 0;
+};
+
+} // namespace queue_sim
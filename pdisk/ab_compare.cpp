@@ -0,0 +1,43 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "engine/easy.h"
+
+#include "ab_comparison.h"
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// A/B comparison of the PDisk models: deltas of RPS and latency percentiles with
+// confidence intervals over replications, regressions are flagged. The same model
+// compared to itself (A/A) must show no deltas, because of the common random numbers
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    std::vector<ModelVariant> variants = {
+        {"Current NVMe", [](ClosedPipeLine& pipeline) { SetupCurrentPdiskModel(pipeline); }},
+        {"Current NVMe (A/A)", [](ClosedPipeLine& pipeline) { SetupCurrentPdiskModel(pipeline); }},
+        {"Slow NVMe", [](ClosedPipeLine& pipeline) { SetupCurrentPdiskModelSlowNVMe(pipeline); }},
+    };
+
+    ComparisonConfig config;
+    config.Replications = 8;
+    config.SimulatedTime = 500 * Msec;
+
+    auto report = CompareVariants(variants, config, GetEngine()->GetBackbuffer());
+
+    auto text = report.GetText();
+    text += report.HasRegression() ? "\nRegression detected\n" : "\nNo regressions\n";
+
+    printf("%s", text.c_str());
+    fflush(stdout);
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 200);
+        ShowFrame();
+    }
+}
@@ -0,0 +1,134 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+
+#include "models.h"
+#include "parallel_sim.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// Cluster of nodes, each node has clients and several PDisks. Clients send
+// requests over the network to random PDisks of the cluster. Each node is a partition
+// of the parallel simulation.
+
+constexpr SimTime tickInterval = 1 * Usec;
+constexpr SimTime simulatedTime = 200 * Msec;
+
+constexpr size_t nodeCount = 32;
+constexpr size_t disksPerNode = 8;
+constexpr size_t clientInflight = 64;
+constexpr SimTime networkLatency = 20 * Usec;
+
+struct Cluster {
+    ParallelSimulation Simulation;
+    std::vector<ClosedLoopClient*> Clients;
+};
+
+// SetupCurrentPdiskModel without the flush controller: it passes events in the order
+// of their ids and waits for every id, while a disk gets only the requests, which
+// clients of all the nodes have sent to it, i.e. a sparse subset of ids
+void SetupPdiskChain(StageChain& chain) {
+    using Config = CurrentPdiskConfig;
+
+    chain.AddQueue("InQ", 0);
+    chain.AddFixedTimeExecutor("PDisk", Config::PdiskThreads, Config::PdiskExecTime);
+    chain.AddQueue("SbmQ", 0);
+    chain.AddFixedTimeExecutor("Sbm", Config::SbmThreads, Config::SbmExecTime);
+    chain.AddPercentileTimeExecutor("NVMe", Config::NVMeInflight, Config::NVMePercentiles());
+}
+
+void SetupCluster(Cluster& cluster) {
+    constexpr size_t diskCount = nodeCount * disksPerNode;
+
+    std::vector<RemoteSender*> requestSenders;
+    std::vector<RemoteReceiver*> responseReceivers;
+    std::vector<RemoteSender*> responseSenders;
+    std::vector<RemoteReceiver*> requestReceivers;
+
+    for (size_t node = 0; node < nodeCount; ++node) {
+        auto& partition = cluster.Simulation.AddPartition();
+
+        auto& clientChain = partition.AddChain();
+        responseReceivers.push_back(clientChain.AddStage<RemoteReceiver>("Responses"));
+        cluster.Clients.push_back(clientChain.AddStage<ClosedLoopClient>("Client", node, clientInflight, diskCount));
+        requestSenders.push_back(clientChain.AddStage<RemoteSender>("Requests", ERemoteRoute::ByDst));
+
+        for (size_t disk = 0; disk < disksPerNode; ++disk) {
+            auto& diskChain = partition.AddChain();
+            requestReceivers.push_back(diskChain.AddStage<RemoteReceiver>("Requests"));
+            SetupPdiskChain(diskChain);
+            responseSenders.push_back(diskChain.AddStage<RemoteSender>("Responses", ERemoteRoute::BySrc));
+        }
+    }
+
+    // requests are routed by destination disk, responses by source client
+    for (auto* sender: requestSenders) {
+        for (auto* receiver: requestReceivers) {
+            cluster.Simulation.Connect(sender, receiver, networkLatency);
+        }
+    }
+
+    for (auto* sender: responseSenders) {
+        for (auto* receiver: responseReceivers) {
+            cluster.Simulation.Connect(sender, receiver, networkLatency);
+        }
+    }
+}
+
+std::string RunCluster(size_t threadCount, double& wallTime) {
+    Cluster cluster;
+    SetupCluster(cluster);
+
+    auto start = std::chrono::steady_clock::now();
+    cluster.Simulation.Run(simulatedTime, tickInterval, threadCount);
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    wallTime = duration.count();
+
+    size_t finishedEvents = 0;
+    auto eventDurationsUs = Histogram::HistogramWithUsBuckets();
+    for (auto* client: cluster.Clients) {
+        finishedEvents += client->GetFinishedEvents();
+        eventDurationsUs.Merge(client->GetEventDurationsUs());
+    }
+
+    return FormatLatencyStats(simulatedTime, finishedEvents, (size_t)(finishedEvents * Sec / simulatedTime), eventDurationsUs);
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    std::vector<size_t> threadCounts = {1};
+    size_t hardwareThreads = std::thread::hardware_concurrency();
+    for (size_t threads = 2; threads <= hardwareThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+
+    std::string text;
+    double singleThreadTime = 0;
+    for (auto threads: threadCounts) {
+        double wallTime = 0;
+        auto stats = RunCluster(threads, wallTime);
+        if (threads == 1) {
+            singleThreadTime = wallTime;
+        }
+
+        char header[256];
+        snprintf(header, sizeof(header), "Threads: %ld, wall time: %.2f s, speedup: %.2f\n",
+            threads, wallTime, singleThreadTime / wallTime);
+        text += header + stats + "\n\n";
+
+        printf("%s%s\n\n", header, stats.c_str());
+        fflush(stdout);
+    }
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 300);
+        ShowFrame();
+    }
+}
@@ -0,0 +1,175 @@
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+
+#include "common.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// Pushes events of different shapes to EventStorage, checks that they are read back
+// unchanged, also after removing some of them, and that the storage takes not more
+// than the expected bytes per event
+
+constexpr size_t eventCount = 1000000;
+
+// 12 bytes per event and a share of the last chunk
+constexpr double maxBytesPerEvent = 12.5;
+
+struct StorageCase {
+    const char* Name;
+
+    // time between pushes
+    SimTime PushInterval;
+
+    // the event to be pushed: called at the push time
+    std::function<Event(size_t i)> NewEvent;
+};
+
+std::string RunStorageCase(const StorageCase& storageCase) {
+    EventStorage storage;
+    std::vector<Event> events;
+    events.reserve(eventCount);
+
+    for (size_t i = 0; i < eventCount; ++i) {
+        AdvanceTime(storageCase.PushInterval);
+        auto event = storageCase.NewEvent(i);
+        event.StartStage();
+        storage.PushBack(event);
+        events.push_back(event);
+    }
+
+    if (storage.Size() != events.size()) {
+        throw std::runtime_error(std::string(storageCase.Name) + ": wrong size");
+    }
+
+    size_t i = 0;
+    storage.ForEach([&](const Event& event) {
+        const auto& expected = events[i++];
+        if (event.GetId() != expected.GetId()
+            || event.GetSrc() != expected.GetSrc()
+            || event.GetDst() != expected.GetDst()
+            || event.GetStartTime() != expected.GetStartTime()
+            || event.GetStageStartTime() != expected.GetStageStartTime())
+        {
+            throw std::runtime_error(std::string(storageCase.Name) + ": event changed");
+        }
+    });
+
+    double bytesPerEvent = (double)storage.GetMemoryBytes() / eventCount;
+    if (bytesPerEvent > maxBytesPerEvent) {
+        throw std::runtime_error(std::string(storageCase.Name) + ": too many bytes per event: "
+            + std::to_string(bytesPerEvent));
+    }
+
+    // cancelled events, e.g. timed out ones
+    constexpr size_t removeEach = 100;
+    for (size_t j = 0; j < eventCount; j += removeEach) {
+        if (!storage.Remove(events[j].GetId()) || storage.Remove(events[j].GetId())) {
+            throw std::runtime_error(std::string(storageCase.Name) + ": wrong remove");
+        }
+    }
+    if (storage.Size() != eventCount - eventCount / removeEach) {
+        throw std::runtime_error(std::string(storageCase.Name) + ": wrong size after remove");
+    }
+
+    for (size_t j = 0; j < eventCount; ++j) {
+        if (j % removeEach == 0) {
+            continue;
+        }
+        if (storage.Front().GetId() != events[j].GetId()) {
+            throw std::runtime_error(std::string(storageCase.Name) + ": wrong event after remove");
+        }
+        storage.PopFront();
+    }
+    if (!storage.Empty()) {
+        throw std::runtime_error(std::string(storageCase.Name) + ": not empty");
+    }
+
+    char text[256];
+    snprintf(text, sizeof(text), "%s: %.2f bytes per event (sizeof(Event): %ld), OK\n",
+        storageCase.Name, bytesPerEvent, sizeof(Event));
+    return text;
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    // issued before, to make events older than 2^32 ns
+    std::vector<Event> oldEvents;
+
+    // issued by blocks and pushed in a random order, like behind an executor with many processors
+    std::vector<Event> permutedEvents;
+    std::mt19937_64 gen(1);
+
+    std::vector<StorageCase> cases = {
+        {"Default events", 100 * Nsec, [](size_t) { return Event::NewEvent(); }},
+        {"16 tenants", 100 * Nsec, [](size_t i) { return Event::NewEvent(i % 16, 0); }},
+        {"64 src/dst pairs", 100 * Nsec, [](size_t i) { return Event::NewEvent(i % 16, i % 64); }},
+        {"Queue longer than 2^32 ns", 10 * Usec, [](size_t i) { return Event::NewEvent(i % 16, 0); }},
+        {"Events older than 2^32 ns", 100 * Nsec, [&oldEvents](size_t i) {
+            if (i == 0) {
+                for (size_t j = 0; j < eventCount; ++j) {
+                    oldEvents.push_back(Event::NewEvent(j % 16, 0));
+                }
+                AdvanceTime(10 * Sec);
+            }
+            return oldEvents[i];
+        }},
+        {"Permuted ids", 100 * Nsec, [&permutedEvents, &gen](size_t i) {
+            constexpr size_t blockSize = 64;
+            if (i % blockSize == 0) {
+                permutedEvents.clear();
+                for (size_t j = 0; j < blockSize; ++j) {
+                    permutedEvents.push_back(Event::NewEvent());
+                }
+                std::shuffle(permutedEvents.begin(), permutedEvents.end(), gen);
+            }
+            return permutedEvents[i % blockSize];
+        }},
+        {"Gapped ids", 100 * Nsec, [](size_t i) {
+            // the events of the other tenants are not in this queue
+            for (size_t j = 0; j < i % 7; ++j) {
+                Event::NewEvent();
+            }
+            return Event::NewEvent(i % 16, 0);
+        }},
+        {"Random gaps in ids", 100 * Nsec, [&gen](size_t) {
+            std::uniform_int_distribution<size_t> dis(0, 1000);
+            for (size_t j = dis(gen); j > 0; --j) {
+                Event::NewEvent();
+            }
+            return Event::NewEvent();
+        }},
+    };
+
+    std::string text;
+    for (const auto& storageCase: cases) {
+        // clock and event counter are per thread, so each case starts from scratch
+        std::string stats;
+        std::thread([&] {
+            try {
+                stats = RunStorageCase(storageCase);
+            } catch (const std::exception& e) {
+                stats = std::string("FAILED: ") + e.what() + "\n";
+            }
+        }).join();
+
+        printf("%s", stats.c_str());
+        fflush(stdout);
+        text += stats;
+    }
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 200);
+        ShowFrame();
+    }
+}
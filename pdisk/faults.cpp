@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+
+#include "fault_injection.h"
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// PDisk under degradation: how long it takes to recover after an episode
+// and which share of the latency tail is caused by the episodes. Clients run
+// open loop at the intended rate, latencies are from the intended start
+
+constexpr SimTime tickInterval = 1 * Usec;
+constexpr SimTime simulatedTime = 5 * Sec;
+
+// PDisk thread can do 200K rps
+constexpr double intendedRate = 150000;
+
+// enough not to limit the intended rate during the episodes
+constexpr size_t clients = 100000;
+
+// consecutive events within the baseline after the episode
+constexpr size_t recoveryWindow = 1000;
+
+using SetupFaults = std::function<void(FaultInjector& injector, ClosedPipeLine& pipeline)>;
+
+struct FaultScenario {
+    const char* Name;
+    SetupFaults Setup;
+};
+
+std::string RunFaultScenario(const FaultScenario& scenario) {
+    ClosedPipeLine pipeline(GetEngine()->GetBackbuffer());
+    SetupCurrentPdiskModel(pipeline);
+    pipeline.AddTenantClients(0, clients, intendedRate);
+
+    FaultInjector injector(recoveryWindow);
+    scenario.Setup(injector, pipeline);
+    pipeline.AddEventFinishedCallback([&injector](const Event& event, SimTime intendedStart) {
+        injector.OnEventFinished(event, intendedStart);
+    });
+
+    while (Now() < simulatedTime) {
+        AdvanceTime(tickInterval);
+        injector.Tick();
+        pipeline.Tick(tickInterval);
+    }
+
+    return std::string(scenario.Name) + "\n" + injector.GetReportText() + pipeline.GetStatsText();
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    std::vector<FaultScenario> scenarios = {
+        {"NVMe is 10x slower for 100 ms", [](FaultInjector& injector, ClosedPipeLine& pipeline) {
+            injector.AddEpisode(pipeline.FindStage("NVMe"), {EFault::Slowdown, 1 * Sec, 100 * Msec, 10});
+        }},
+        {"PDisk thread stalled for 10 ms", [](FaultInjector& injector, ClosedPipeLine& pipeline) {
+            injector.AddEpisode(pipeline.FindStage("PDisk"), {EFault::Stall, 1 * Sec, 10 * Msec});
+        }},
+        {"NVMe lost 126 of 128 inflight slots for 100 ms", [](FaultInjector& injector, ClosedPipeLine& pipeline) {
+            FaultEpisode episode{EFault::ProcessorLoss, 1 * Sec, 100 * Msec};
+            episode.LostProcessors = 126;
+            injector.AddEpisode(pipeline.FindStage("NVMe"), episode);
+        }},
+        {"SbmQ frozen for 10 ms", [](FaultInjector& injector, ClosedPipeLine& pipeline) {
+            injector.AddEpisode(pipeline.FindStage("SbmQ"), {EFault::Freeze, 1 * Sec, 10 * Msec});
+        }},
+        {"Random 1 ms PDisk stalls (every 100 ms) and 5 ms NVMe slowdowns (every 500 ms)",
+            [](FaultInjector& injector, ClosedPipeLine& pipeline) {
+                injector.AddRandomEpisodes(pipeline.FindStage("PDisk"), {EFault::Stall, 0, 1 * Msec},
+                    100 * Msec, 0, simulatedTime);
+                injector.AddRandomEpisodes(pipeline.FindStage("NVMe"), {EFault::Slowdown, 0, 5 * Msec, 4},
+                    500 * Msec, 0, simulatedTime);
+            }},
+    };
+
+    std::string text;
+    for (const auto& scenario: scenarios) {
+        // clock and event counter are per thread, so each run starts from scratch
+        std::string stats;
+        std::thread([&] { stats = RunFaultScenario(scenario); }).join();
+
+        printf("%s\n\n", stats.c_str());
+        fflush(stdout);
+        text += stats + "\n\n";
+    }
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 200);
+        ShowFrame();
+    }
+}
@@ -0,0 +1,95 @@
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// Passing events from PDisk thread to Sbm thread: free (the current model), futex
+// wakeups, busy polling and both parts of the work merged into a single thread.
+// Clients run open loop at the intended rate, latencies are from the intended start
+
+constexpr SimTime tickInterval = 1 * Usec;
+constexpr SimTime simulatedTime = 2 * Sec;
+
+// enough not to limit the intended rate
+constexpr size_t clients = 100000;
+
+struct HandoffVariant {
+    const char* Name;
+    std::function<void(ClosedPipeLine& pipeline)> Setup;
+
+    // has the handoff stage
+    bool HasHandoff = false;
+};
+
+std::string RunVariant(const HandoffVariant& variant, double rps) {
+    ClosedPipeLine pipeline(GetEngine()->GetBackbuffer());
+    variant.Setup(pipeline);
+    pipeline.AddTenantClients(0, clients, rps);
+
+    while (Now() < simulatedTime) {
+        AdvanceTime(tickInterval);
+        pipeline.Tick(tickInterval);
+    }
+
+    auto results = pipeline.GetResults();
+    const auto& intended = results.IntendedStartLatencyUs;
+
+    char handoffText[128] = "";
+    if (variant.HasHandoff) {
+        auto* handoff = static_cast<ThreadHandoff*>(pipeline.FindStage("SbmQ"));
+        snprintf(handoffText, sizeof(handoffText), ", wakeups: %ld, spin hits: %ld",
+            handoff->GetWakeups(), handoff->GetSpinHits());
+    }
+
+    char text[512];
+    snprintf(text, sizeof(text),
+        "%-12s at %.0f rps: achieved %.0f rps, p50: %d us, p99: %d us, p99.9: %d us%s\n",
+        variant.Name, rps, results.ThroughputRps,
+        intended.P50Us, intended.P99Us, intended.P999Us, handoffText);
+    return text;
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    std::vector<HandoffVariant> variants = {
+        {"Current", [](ClosedPipeLine& pipeline) { SetupCurrentPdiskModel(pipeline); }},
+        {"Futex", [](ClosedPipeLine& pipeline) { SetupCurrentPdiskModelWithHandoff(pipeline, FutexHandoff()); }, true},
+        {"Busy polling", [](ClosedPipeLine& pipeline) { SetupCurrentPdiskModelWithHandoff(pipeline, BusyPollingHandoff()); }, true},
+        {"Merged", [](ClosedPipeLine& pipeline) { SetupMergedPdiskSbmModel(pipeline); }},
+    };
+
+    // PDisk thread can do 200K rps, the merged one ~140K rps
+    std::vector<double> rates = {50000, 100000, 130000, 180000};
+
+    std::string text;
+    for (auto rps: rates) {
+        for (const auto& variant: variants) {
+            // clock and event counter are per thread, so each run starts from scratch
+            std::string stats;
+            std::thread([&] { stats = RunVariant(variant, rps); }).join();
+
+            printf("%s", stats.c_str());
+            fflush(stdout);
+            text += stats;
+        }
+
+        printf("\n");
+        fflush(stdout);
+        text += "\n";
+    }
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 200);
+        ShowFrame();
+    }
+}
@@ -0,0 +1,86 @@
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// Hedged NVMe writes and timeouts: the trade-off between the tail latency and the extra load.
+// Device latencies are a few discrete values, e.g. p90 and p99 are both 50 us, thus
+// fixed delays are swept around them too
+
+constexpr SimTime tickInterval = 1 * Usec;
+constexpr SimTime simulatedTime = 2 * Sec;
+
+struct HedgingRun {
+    const char* Name;
+    HedgingPolicy Policy;
+    SimTime Timeout = 0;
+};
+
+std::string RunHedging(const HedgingRun& run) {
+    ClosedPipeLine pipeline(GetEngine()->GetBackbuffer());
+    auto* nvme = SetupPdiskModelWithHedgedNVMe(pipeline, run.Policy);
+    pipeline.SetEventTimeout(run.Timeout);
+
+    while (Now() < simulatedTime) {
+        AdvanceTime(tickInterval);
+        pipeline.Tick(tickInterval);
+    }
+
+    auto nvmeUs = nvme->GetLatencyUs();
+
+    char delay[64] = "never";
+    if (nvme->GetCurrentHedgeDelay() != HedgingPolicy::Never) {
+        snprintf(delay, sizeof(delay), "%.1f us", (double)nvme->GetCurrentHedgeDelay() / Usec);
+    }
+
+    char text[256];
+    snprintf(text, sizeof(text),
+        "%s: hedge delay: %s, extra load: %.2f%%, hedge wins: %.1f%%, NVMe p50: %d us, p99: %d us, p100: %d us\n",
+        run.Name, delay, 100 * nvme->GetHedgedShare(), 100 * nvme->GetHedgeWinShare(),
+        nvmeUs.GetPercentile(50), nvmeUs.GetPercentile(99), nvmeUs.GetPercentile(100));
+
+    return text + pipeline.GetStatsText();
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    std::vector<HedgingRun> runs = {
+        {"No hedging", HedgingPolicy::NoHedging()},
+        {"Hedge after p50", HedgingPolicy::AfterPercentile(50)},
+        {"Hedge after p90", HedgingPolicy::AfterPercentile(90)},
+        {"Hedge after p99", HedgingPolicy::AfterPercentile(99)},
+        {"Hedge after p99.9", HedgingPolicy::AfterPercentile(99.9)},
+        {"Hedge after 30 us", HedgingPolicy::AfterDelay(30 * Usec)},
+        {"Hedge after 50 us", HedgingPolicy::AfterDelay(50 * Usec)},
+        {"Hedge after 60 us", HedgingPolicy::AfterDelay(60 * Usec)},
+        {"Hedge after 100 us", HedgingPolicy::AfterDelay(100 * Usec)},
+        {"Hedge after 500 us", HedgingPolicy::AfterDelay(500 * Usec)},
+        {"No hedging, 1 ms timeout", HedgingPolicy::NoHedging(), 1 * Msec},
+        {"Hedge after p99, 1 ms timeout", HedgingPolicy::AfterPercentile(99), 1 * Msec},
+    };
+
+    std::string text;
+    for (const auto& run: runs) {
+        // clock and event counter are per thread, so each run starts from scratch
+        std::string stats;
+        std::thread([&] { stats = RunHedging(run); }).join();
+
+        printf("%s\n\n", stats.c_str());
+        fflush(stdout);
+        text += stats + "\n\n";
+    }
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 200);
+        ShowFrame();
+    }
+}
@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// The PDisk model at the fixed intended rate below and above its capacity: latency from
+// the intended start vs from the actual start, per-stage breakdown, Little's law checks.
+// Results of each run are saved to latency_report_<rate>.json
+
+constexpr SimTime tickInterval = 1 * Usec;
+constexpr SimTime simulatedTime = 2 * Sec;
+
+std::string RunAtRate(double rps) {
+    ClosedPipeLine pipeline(GetEngine()->GetBackbuffer());
+    SetupCurrentPdiskModel(pipeline);
+    pipeline.SetIntendedRate(rps);
+
+    while (Now() < simulatedTime) {
+        AdvanceTime(tickInterval);
+        pipeline.Tick(tickInterval);
+    }
+
+    auto results = pipeline.GetResults();
+    results.SaveJson("latency_report_" + std::to_string((size_t)rps) + ".json");
+
+    const auto& intended = results.IntendedStartLatencyUs;
+    const auto& service = results.ServiceLatencyUs;
+
+    char text[512];
+    snprintf(text, sizeof(text),
+        "Intended rate: %.0f rps, achieved: %.0f rps\n"
+        "From intended start p50: %d us, p99: %d us, p99.9: %d us\n"
+        "From actual start   p50: %d us, p99: %d us, p99.9: %d us\n"
+        "Max Little's law error: %.2f%%\n",
+        rps, results.ThroughputRps,
+        intended.P50Us, intended.P99Us, intended.P999Us,
+        service.P50Us, service.P99Us, service.P999Us,
+        100 * results.GetMaxLittleLawError());
+
+    return text + results.GetStagesText();
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    // the model finishes ~195K events per second, when clients aren't paced
+    std::vector<double> rates = {100000, 150000, 180000, 190000, 200000};
+
+    std::string text;
+    for (auto rps: rates) {
+        // clock and event counter are per thread, so each run starts from scratch
+        std::string stats;
+        std::thread([&] { stats = RunAtRate(rps); }).join();
+
+        printf("%s\n", stats.c_str());
+        fflush(stdout);
+        text += stats + "\n";
+    }
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 200);
+        ShowFrame();
+    }
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "hedging.h"
+#include "rate_limiter.h"
+#include "replication.h"
+#include "simple_pipeline.h"
+#include "static_pipeline.h"
+
+// PDisk models. Setup functions are templates when the model can be run
+// both by ClosedPipeLine and by RealThreadPipeLine.
+
+namespace queue_sim {
+
+// ----------------------------
+// CurrentPdiskConfig: the current PDisk, shared by all the models below
+
+struct CurrentPdiskConfig {
+    static constexpr size_t PdiskThreads = 1;
+    static constexpr SimTime PdiskExecTime = 5 * Usec;
+
+    static constexpr size_t SbmThreads = 1;
+    static constexpr SimTime SbmExecTime = 2 * Usec;
+
+    static constexpr size_t NVMeInflight = 128;
+
+    static PercentileTimeProcessor::Percentiles NVMePercentiles() {
+        return {
+            {16.47, 12 * Usec},
+            {87.26, 25 * Usec},
+            {99.7, 50 * Usec},
+            {99.992, 100 * Usec},
+            {99.9968, 200 * Usec},
+            {100, 4000 * Usec},
+        };
+    }
+
+    static PercentileTimeProcessor::Percentiles SlowNVMePercentiles() {
+        return {
+            {3.813, 12 * Usec},
+            {51.59, 25 * Usec},
+            {98.851, 50 * Usec},
+            {99.956, 100 * Usec},
+            {99.983, 200 * Usec},
+            {99.983, 200 * Usec},
+            {100, 4000 * Usec},
+        };
+    }
+};
+
+template <typename TPipeline>
+void SetupCurrentPdiskModel(TPipeline &pipeline, size_t startQueueSize = 32) {
+    using Config = CurrentPdiskConfig;
+
+    pipeline.AddQueue("InQ", startQueueSize);
+    pipeline.AddFixedTimeExecutor("PDisk", Config::PdiskThreads, Config::PdiskExecTime);
+    pipeline.AddQueue("SbmQ", 0);
+    pipeline.AddFixedTimeExecutor("Sbm", Config::SbmThreads, Config::SbmExecTime);
+    pipeline.AddPercentileTimeExecutor("NVMe", Config::NVMeInflight, Config::NVMePercentiles());
+    pipeline.AddFlushController("Flush");
+}
+
+template <typename TPipeline>
+void SetupCurrentPdiskModelSlowNVMe(TPipeline &pipeline, size_t startQueueSize = 32) {
+    using Config = CurrentPdiskConfig;
+
+    pipeline.AddQueue("InQ", startQueueSize);
+    pipeline.AddFixedTimeExecutor("PDisk", Config::PdiskThreads, Config::PdiskExecTime);
+    pipeline.AddQueue("SbmQ", 0);
+    pipeline.AddFixedTimeExecutor("Sbm", Config::SbmThreads, Config::SbmExecTime);
+    pipeline.AddPercentileTimeExecutor("NVMe", Config::NVMeInflight, Config::SlowNVMePercentiles());
+    pipeline.AddFlushController("Flush");
+}
+
+// same as SetupCurrentPdiskModel, but passing events from PDisk thread to Sbm thread is not free
+template <typename TPipeline>
+void SetupCurrentPdiskModelWithHandoff(TPipeline &pipeline, ThreadHandoffConfig handoffConfig, size_t startQueueSize = 32) {
+    using Config = CurrentPdiskConfig;
+
+    pipeline.AddQueue("InQ", startQueueSize);
+    pipeline.AddFixedTimeExecutor("PDisk", Config::PdiskThreads, Config::PdiskExecTime);
+    pipeline.AddThreadHandoff("SbmQ", handoffConfig);
+    pipeline.AddFixedTimeExecutor("Sbm", Config::SbmThreads, Config::SbmExecTime);
+    pipeline.AddPercentileTimeExecutor("NVMe", Config::NVMeInflight, Config::NVMePercentiles());
+    pipeline.AddFlushController("Flush");
+}
+
+// SetupCurrentPdiskModel with the stages known at compile time
+using CurrentPdiskStaticModel = StaticPipeLine<
+    Queue,
+    Executor<FixedTimeProcessor>,
+    Queue,
+    Executor<FixedTimeProcessor>,
+    Executor<PercentileTimeProcessor>,
+    FlushController>;
+
+inline CurrentPdiskStaticModel MakeCurrentPdiskStaticModel(Sprite sprite, size_t startQueueSize = 32) {
+    using Config = CurrentPdiskConfig;
+
+    return CurrentPdiskStaticModel(
+        sprite,
+        Queue("InQ", startQueueSize),
+        Executor<FixedTimeProcessor>("PDisk", Config::PdiskThreads, Config::PdiskExecTime),
+        Queue("SbmQ", 0),
+        Executor<FixedTimeProcessor>("Sbm", Config::SbmThreads, Config::SbmExecTime),
+        Executor<PercentileTimeProcessor>("NVMe", Config::NVMeInflight, Config::NVMePercentiles()),
+        FlushController("Flush"));
+}
+
+inline ThreadHandoffConfig FutexHandoff() {
+    ThreadHandoffConfig config;
+    config.WakeupLatency = 5 * Usec;
+    config.ContextSwitchTime = 2 * Usec;
+    config.CacheMigrationTime = 1 * Usec;
+    config.SpinWindow = 0;
+    return config;
+}
+
+inline ThreadHandoffConfig BusyPollingHandoff() {
+    ThreadHandoffConfig config;
+    config.CacheMigrationTime = 1 * Usec;
+    config.SpinWindow = ThreadHandoffConfig::NeverSleep;
+    return config;
+}
+
+// same as SetupCurrentPdiskModel, but PDisk and Sbm work is done by the same thread,
+// i.e. there is no handoff at all, but the thread does both parts of the work
+template <typename TPipeline>
+void SetupMergedPdiskSbmModel(TPipeline &pipeline, size_t startQueueSize = 32) {
+    using Config = CurrentPdiskConfig;
+
+    pipeline.AddQueue("InQ", startQueueSize);
+    pipeline.AddFixedTimeExecutor("PDisk+Sbm", Config::PdiskThreads, Config::PdiskExecTime + Config::SbmExecTime);
+    pipeline.AddPercentileTimeExecutor("NVMe", Config::NVMeInflight, Config::NVMePercentiles());
+    pipeline.AddFlushController("Flush");
+}
+
+// same as SetupCurrentPdiskModel, but NVMe is modelled as a stateful device:
+// latency depends on in-flight depth, and there are GC and write buffer stalls
+inline void SetupPdiskModelWithNVMeDevice(ClosedPipeLine &pipeline, size_t NVMeInflight = CurrentPdiskConfig::NVMeInflight) {
+    using Config = CurrentPdiskConfig;
+
+    constexpr size_t startQueueSize = 32;
+
+    NVMeDeviceConfig config;
+    config.MaxInflight = NVMeInflight;
+    config.Channels = 8;
+    config.DiesPerChannel = 4;
+    config.WriteFraction = 1.0;
+    config.ReadPercentiles = {
+        {50, 60 * Usec},
+        {99, 90 * Usec},
+        {100, 200 * Usec},
+    };
+
+    // the current percentiles without the 4 ms tail: the device has GC stalls instead
+    config.WritePercentiles = Config::NVMePercentiles();
+    config.WritePercentiles.pop_back();
+    config.WritePercentiles.back().Percentile = 100;
+
+    config.ChannelTransferTime = 1 * Usec;
+    config.LatencyCurve = {
+        {1, 1.0},
+        {32, 1.0},
+        {64, 1.3},
+        {128, 2.0},
+        {256, 4.0},
+    };
+    config.ReadWriteInterference = 1.0;
+    config.GcIntervalMean = 200 * Msec;
+    config.GcStallTime = 4000 * Usec;
+    config.WriteBufferFlushWrites = 4096;
+    config.WriteBufferFlushTime = 200 * Usec;
+
+    pipeline.AddQueue("InQ", startQueueSize);
+    pipeline.AddFixedTimeExecutor("PDisk", Config::PdiskThreads, Config::PdiskExecTime);
+    pipeline.AddQueue("SbmQ", 0);
+    pipeline.AddFixedTimeExecutor("Sbm", Config::SbmThreads, Config::SbmExecTime);
+    pipeline.AddNVMeDevice("NVMe", config);
+    pipeline.AddFlushController("Flush");
+}
+
+// replicated write: proxy sends each write to several PDisks (over the network)
+// and waits for the quorum, the first slowReplicas replicas have slow NVMe
+inline ReplicatedWrite* SetupReplicatedWriteModel(
+    ClosedPipeLine &pipeline,
+    size_t replicas = 3,
+    size_t quorum = 2,
+    size_t slowReplicas = 0,
+    NetworkLinkConfig networkConfig = {})
+{
+    constexpr size_t startQueueSize = 32;
+
+    constexpr size_t proxyThreads = 1;
+    constexpr SimTime proxyExecTime = 1 * Usec;
+
+    auto setupReplica = [=](StageChain& chain, size_t replica) {
+        chain.AddNetworkLink("Request", networkConfig);
+        if (replica < slowReplicas) {
+            SetupCurrentPdiskModelSlowNVMe(chain, 0);
+        } else {
+            SetupCurrentPdiskModel(chain, 0);
+        }
+        chain.AddNetworkLink("Response", networkConfig);
+    };
+
+    pipeline.AddQueue("InQ", startQueueSize);
+    pipeline.AddFixedTimeExecutor("Proxy", proxyThreads, proxyExecTime);
+    return pipeline.AddStage<ReplicatedWrite>("Quorum", replicas, quorum, setupReplica);
+}
+
+// same as SetupCurrentPdiskModel, but there are two NVMe devices, each gets a half of writes.
+// A write, which is slower than the policy allows, is duplicated to the other device
+inline HedgedExecutor* SetupPdiskModelWithHedgedNVMe(ClosedPipeLine &pipeline, HedgingPolicy policy, size_t startQueueSize = 32) {
+    using Config = CurrentPdiskConfig;
+
+    // the same in-flight in total
+    constexpr size_t devices = 2;
+    constexpr size_t NVMeInflight = Config::NVMeInflight / devices;
+
+    auto setupDevice = [](StageChain& chain, size_t) {
+        chain.AddPercentileTimeExecutor("Device", NVMeInflight, Config::NVMePercentiles());
+    };
+
+    pipeline.AddQueue("InQ", startQueueSize);
+    pipeline.AddFixedTimeExecutor("PDisk", Config::PdiskThreads, Config::PdiskExecTime);
+    pipeline.AddQueue("SbmQ", 0);
+    pipeline.AddFixedTimeExecutor("Sbm", Config::SbmThreads, Config::SbmExecTime);
+    auto* nvme = pipeline.AddStage<HedgedExecutor>("NVMe", devices, policy, setupDevice);
+    pipeline.AddFlushController("Flush");
+    return nvme;
+}
+
+// same as SetupCurrentPdiskModel, but events pass admission control before PDisk.
+// There is no flush controller: it orders events by ids, i.e. by the moment clients
+// have issued them, while the admission control reorders tenants (in PDisk the log
+// order is assigned after the admission). There are no clients, they are added
+// by ClosedPipeLine::AddTenantClients
+inline RateLimiter* SetupPdiskModelWithRateLimiter(ClosedPipeLine &pipeline, std::unique_ptr<RateLimitAlgorithm> algorithm) {
+    using Config = CurrentPdiskConfig;
+
+    pipeline.AddQueue("InQ", 0);
+    auto* limiter = pipeline.AddStage<RateLimiter>("QoS", std::move(algorithm));
+    pipeline.AddFixedTimeExecutor("PDisk", Config::PdiskThreads, Config::PdiskExecTime);
+    pipeline.AddQueue("SbmQ", 0);
+    pipeline.AddFixedTimeExecutor("Sbm", Config::SbmThreads, Config::SbmExecTime);
+    pipeline.AddPercentileTimeExecutor("NVMe", Config::NVMeInflight, Config::NVMePercentiles());
+
+    pipeline.AddEventFinishedCallback([limiter](const Event& event, SimTime) { limiter->OnEventFinished(event); });
+    return limiter;
+}
+
+} // namespace queue_sim
@@ -0,0 +1,76 @@
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// The PDisk model with the stateful NVMe device: throughput vs tail latency depending
+// on the max in-flight depth of the device. Deep queues hide the device latency, but
+// the latency grows with the in-flight depth. Clients run open loop at the intended rate,
+// latencies are from the intended start. Note, that PDisk thread limits the rate to 200K rps
+// and p99 is mostly caused by GC stalls of the device
+
+constexpr SimTime tickInterval = 1 * Usec;
+constexpr SimTime simulatedTime = 2 * Sec;
+
+// enough not to limit the intended rate
+constexpr size_t clients = 100000;
+
+std::string RunSweepPoint(size_t maxInflight, double rps) {
+    ClosedPipeLine pipeline(GetEngine()->GetBackbuffer());
+    SetupPdiskModelWithNVMeDevice(pipeline, maxInflight);
+    pipeline.AddTenantClients(0, clients, rps);
+
+    while (Now() < simulatedTime) {
+        AdvanceTime(tickInterval);
+        pipeline.Tick(tickInterval);
+    }
+
+    auto results = pipeline.GetResults();
+    const auto& intended = results.IntendedStartLatencyUs;
+
+    char text[256];
+    snprintf(text, sizeof(text),
+        "MaxInflight %3ld at %.0f rps: achieved %.0f rps, p50: %d us, p90: %d us, p99: %d us, p99.9: %d us\n",
+        maxInflight, rps, results.ThroughputRps,
+        intended.P50Us, intended.P90Us, intended.P99Us, intended.P999Us);
+    return text;
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    std::vector<size_t> inflights = {8, 16, 32, 64, 128, 256};
+
+    // PDisk thread can do 200K rps
+    std::vector<double> rates = {100000, 150000, 190000};
+
+    std::string text;
+    for (auto rps: rates) {
+        for (auto maxInflight: inflights) {
+            // clock and event counter are per thread, so each run starts from scratch
+            std::string stats;
+            std::thread([&] { stats = RunSweepPoint(maxInflight, rps); }).join();
+
+            printf("%s", stats.c_str());
+            fflush(stdout);
+            text += stats;
+        }
+
+        printf("\n");
+        fflush(stdout);
+        text += "\n";
+    }
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 200);
+        ShowFrame();
+    }
+}
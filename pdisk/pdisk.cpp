@@ -1,68 +1,56 @@
+#include <cstdio>
 #include <deque>
+#include <functional>
 
 #include "engine/easy.h"
 
 #include "simple_pipeline.h"
+#include "models.h"
 
 using namespace arctic;  // NOLINT
 using namespace queue_sim;  // NOLINT
 
-constexpr double updateScreenInterval = 0.8;
-constexpr double tickInterval = 1 * Usec;
+constexpr SimTime updateScreenInterval = 800 * Msec;
+constexpr SimTime tickInterval = 1 * Usec;
 
-void SetupCurrentPdiskModel(ClosedPipeLine &pipeline) {
-    constexpr size_t startQueueSize = 32;
+// S saves the snapshot, L loads it
+const char* snapshotPath = "pdisk.snapshot";
 
-    constexpr size_t pdiskThreads = 1;
-    constexpr double pdiskExecTime = 5 * Usec;
+// R saves the results: latencies, per-stage breakdown and Little's law checks
+const char* resultsPath = "pdisk_results.json";
 
-    constexpr size_t sbmThreads = 1;
-    constexpr double sbmExecTime = 2 * Usec;
+// F forks the what-if variants from the current state
+constexpr SimTime whatIfTime = 10 * Sec;
 
-    constexpr size_t NVMeInflight = 128;
-    PercentileTimeProcessor::Percentiles diskPercentilesUs = {
-        {16.47, 12 * Usec},
-        {87.26, 25 * Usec},
-        {99.7, 50 * Usec},
-        {99.992, 100 * Usec},
-        {99.9968, 200 * Usec},
-        {100, 4000 * Usec},
-    };
+struct WhatIfVariant {
+    const char* Name;
+    std::function<void(ClosedPipeLine&)> Setup;
+};
 
-    pipeline.AddQueue("InQ", startQueueSize);
-    pipeline.AddFixedTimeExecutor("PDisk", pdiskThreads, pdiskExecTime);
-    pipeline.AddQueue("SbmQ", 0);
-    pipeline.AddFixedTimeExecutor("Sbm", sbmThreads, sbmExecTime);
-    pipeline.AddPercentileTimeExecutor("NVMe", NVMeInflight, diskPercentilesUs);
-    pipeline.AddFlushController("Flush");
-}
+void RunWhatIf(const ClosedPipeLine& pipeline) {
+    std::vector<WhatIfVariant> variants = {
+        {"Slow NVMe", [](ClosedPipeLine& pipeline) { SetupCurrentPdiskModelSlowNVMe(pipeline); }},
+        {"Current NVMe", [](ClosedPipeLine& pipeline) { SetupCurrentPdiskModel(pipeline); }},
+    };
 
-void SetupCurrentPdiskModelSlowNVMe(ClosedPipeLine &pipeline) {
-    constexpr size_t startQueueSize = 32;
+    SnapshotWriter writer;
+    pipeline.SaveSnapshot(writer);
 
-    constexpr size_t pdiskThreads = 1;
-    constexpr double pdiskExecTime = 5 * Usec;
+    ForkVariants(variants.size(), [&](size_t variant) {
+        ClosedPipeLine variantPipeline(GetEngine()->GetBackbuffer());
+        variants[variant].Setup(variantPipeline);
 
-    constexpr size_t sbmThreads = 1;
-    constexpr double sbmExecTime = 2 * Usec;
+        SnapshotReader reader(writer.GetData());
+        variantPipeline.LoadSnapshot(reader);
 
-    constexpr size_t NVMeInflight = 128;
-    PercentileTimeProcessor::Percentiles diskPercentilesUs = {
-        {3.813, 12 * Usec},
-        {51.59, 25 * Usec},
-        {98.851, 50 * Usec},
-        {99.956, 100 * Usec},
-        {99.983, 200 * Usec},
-        {99.983, 200 * Usec},
-        {100, 4000 * Usec},
-    };
+        auto finishTime = Now() + whatIfTime;
+        while (Now() < finishTime) {
+            AdvanceTime(tickInterval);
+            variantPipeline.Tick(tickInterval);
+        }
 
-    pipeline.AddQueue("InQ", startQueueSize);
-    pipeline.AddFixedTimeExecutor("PDisk", pdiskThreads, pdiskExecTime);
-    pipeline.AddQueue("SbmQ", 0);
-    pipeline.AddFixedTimeExecutor("Sbm", sbmThreads, sbmExecTime);
-    pipeline.AddPercentileTimeExecutor("NVMe", NVMeInflight, diskPercentilesUs);
-    pipeline.AddFlushController("Flush");
+        printf("%s:\n%s\n", variants[variant].Name, variantPipeline.GetStatsText().c_str());
+    });
 }
 
 void EasyMain() {
@@ -71,14 +59,30 @@ void EasyMain() {
     ClosedPipeLine pipeline(GetEngine()->GetBackbuffer());
     SetupCurrentPdiskModelSlowNVMe(pipeline);
 
-    double prevTime = 0;
+    SimTime prevTime = 0;
 
-    double currentTime = Now();
+    SimTime currentTime = Now();
 
     for (size_t i = 0; i < 10000000000000; ++i) {
         if (IsKeyDownward(kKeyEscape)) {
             break;
         }
+        if (IsKeyDownward(kKeyS)) {
+            SnapshotWriter writer;
+            pipeline.SaveSnapshot(writer);
+            writer.SaveToFile(snapshotPath);
+        }
+        if (IsKeyDownward(kKeyL)) {
+            auto reader = SnapshotReader::FromFile(snapshotPath);
+            pipeline.LoadSnapshot(reader);
+            prevTime = Now();
+        }
+        if (IsKeyDownward(kKeyR)) {
+            pipeline.GetResults().SaveJson(resultsPath);
+        }
+        if (IsKeyDownward(kKeyF)) {
+            RunWhatIf(pipeline);
+        }
         AdvanceTime(tickInterval);
         pipeline.Tick(tickInterval);
 
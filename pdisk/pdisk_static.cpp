@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "engine/easy.h"
+
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// runs the PDisk model by the dynamic and by the compile time pipeline, compares the speed of the simulation.
+// Both runs have the same seed, thus they must have exactly the same results
+
+constexpr SimTime tickInterval = 1 * Usec;
+constexpr SimTime simulatedTime = 10 * Sec;
+constexpr uint64_t seed = 1;
+
+template <typename TPipeline>
+std::string RunPipeline(const char* name, TPipeline& pipeline, PipeLineResults& results) {
+    auto start = std::chrono::steady_clock::now();
+    while (Now() < simulatedTime) {
+        AdvanceTime(tickInterval);
+        pipeline.Tick(tickInterval);
+    }
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    results = pipeline.GetResults();
+
+    char header[256];
+    snprintf(header, sizeof(header), "%s: wall time: %.2f s, ticks/s: %.2fM\n",
+        name, duration.count(), (double)(simulatedTime / tickInterval) / duration.count() / 1e6);
+
+    return header + pipeline.GetStatsText();
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    // clock, event counter and seeds are per thread, so each run starts from scratch
+    std::string dynamicStats;
+    PipeLineResults dynamicResults;
+    std::thread([&] {
+        SetSimulationSeed(seed);
+        ClosedPipeLine pipeline(GetEngine()->GetBackbuffer());
+        SetupCurrentPdiskModel(pipeline);
+        dynamicStats = RunPipeline("ClosedPipeLine", pipeline, dynamicResults);
+    }).join();
+
+    std::string staticStats;
+    PipeLineResults staticResults;
+    std::thread([&] {
+        SetSimulationSeed(seed);
+        auto pipeline = MakeCurrentPdiskStaticModel(GetEngine()->GetBackbuffer());
+        staticStats = RunPipeline("StaticPipeLine", pipeline, staticResults);
+    }).join();
+
+    auto text = dynamicStats + "\n\n" + staticStats;
+    printf("%s\n", text.c_str());
+    fflush(stdout);
+
+    // finished events, latency percentiles and stage stats
+    if (dynamicResults.FinishedEvents != staticResults.FinishedEvents
+        || dynamicResults.ToJson() != staticResults.ToJson())
+    {
+        throw std::runtime_error("Pipelines have different results with the same seed");
+    }
+    printf("Results are the same\n");
+    fflush(stdout);
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 500);
+        ShowFrame();
+    }
+}
@@ -0,0 +1,31 @@
+#include <cstdio>
+
+#include "engine/easy.h"
+
+#include "real_thread_pipeline.h"
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// runs the PDisk model with real threads, compare the output with the simulation of the same model
+
+constexpr SimTime runTime = 10 * Sec;
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    RealThreadPipeLine pipeline;
+    SetupCurrentPdiskModel(pipeline);
+
+    pipeline.Run(runTime);
+
+    auto text = pipeline.GetStatsText();
+    printf("%s\n", text.c_str());
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 500);
+        ShowFrame();
+    }
+}
@@ -0,0 +1,108 @@
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine/easy.h"
+
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// Admission control for the PDisk shared by tenants: a noisy tenant tries to take
+// more than the PDisk can do, the quiet ones should keep their latency. Latencies
+// are from the intended start, throttling delay is reported separately
+
+constexpr SimTime tickInterval = 1 * Usec;
+constexpr SimTime simulatedTime = 2 * Sec;
+
+constexpr size_t noisyTenant = 1;
+constexpr size_t noisyClients = 64;
+constexpr double noisyRate = 190000;
+
+constexpr size_t quietTenants[] = {2, 3};
+constexpr size_t quietClients = 8;
+constexpr double quietRate = 10000;
+
+using MakeAlgorithm = std::function<std::unique_ptr<RateLimitAlgorithm>()>;
+
+struct LimitScenario {
+    const char* Name;
+    MakeAlgorithm Algorithm;
+    bool WithNoisyTenant = true;
+};
+
+std::string RunScenario(const LimitScenario& scenario) {
+    ClosedPipeLine pipeline(GetEngine()->GetBackbuffer());
+    auto* limiter = SetupPdiskModelWithRateLimiter(pipeline, scenario.Algorithm());
+
+    if (scenario.WithNoisyTenant) {
+        pipeline.AddTenantClients(noisyTenant, noisyClients, noisyRate);
+    }
+    for (auto tenant: quietTenants) {
+        pipeline.AddTenantClients(tenant, quietClients, quietRate);
+    }
+
+    while (Now() < simulatedTime) {
+        AdvanceTime(tickInterval);
+        pipeline.Tick(tickInterval);
+    }
+
+    auto results = pipeline.GetResults();
+
+    std::string text = std::string(scenario.Name) + "\n" + results.GetTenantsText();
+    for (const auto& tenant: results.Tenants) {
+        if (auto* delayUs = limiter->GetTenantThrottlingDelayUs(tenant.Id)) {
+            char throttling[128];
+            snprintf(throttling, sizeof(throttling), "Tenant %ld throttled: %.1f%%, delay p50: %d us, p99: %d us\n",
+                tenant.Id, 100 * limiter->GetTenantThrottledShare(tenant.Id),
+                delayUs->GetPercentile(50), delayUs->GetPercentile(99));
+            text += throttling;
+        }
+    }
+
+    char summary[128];
+    snprintf(summary, sizeof(summary), "Throttled: %.1f%% of events, %s\n",
+        100 * limiter->GetThrottledShare(), limiter->GetAlgorithm().GetText().c_str());
+    return text + summary;
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    std::vector<LimitScenario> scenarios = {
+        {"Quiet tenants only", [] { return std::make_unique<TokenBucketLimit>(); }, false},
+        {"No admission control", [] { return std::make_unique<TokenBucketLimit>(); }},
+        {"Token bucket: noisy tenant 150K rps, burst 64", [] {
+            auto limit = std::make_unique<TokenBucketLimit>();
+            limit->SetTenantLimit(noisyTenant, {150000, 64});
+            return limit;
+        }},
+        {"AIMD concurrency limit, 200 us target", [] {
+            return std::make_unique<AimdLimit>(ConcurrencyLimitConfig{}, AimdConfig{200 * Usec});
+        }},
+        {"Vegas concurrency limit", [] {
+            return std::make_unique<VegasLimit>(ConcurrencyLimitConfig{}, VegasConfig{});
+        }},
+    };
+
+    std::string text;
+    for (const auto& scenario: scenarios) {
+        // clock and event counter are per thread, so each run starts from scratch
+        std::string stats;
+        std::thread([&] { stats = RunScenario(scenario); }).join();
+
+        printf("%s\n", stats.c_str());
+        fflush(stdout);
+        text += stats + "\n";
+    }
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 200);
+        ShowFrame();
+    }
+}
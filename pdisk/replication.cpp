@@ -0,0 +1,66 @@
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "engine/easy.h"
+
+#include "models.h"
+
+using namespace arctic;  // NOLINT
+using namespace queue_sim;  // NOLINT
+
+// Replicated write with quorum: how write latency depends on the number of slow disks in the group
+
+constexpr SimTime tickInterval = 1 * Usec;
+constexpr SimTime simulatedTime = 1 * Sec;
+
+constexpr size_t replicas = 3;
+constexpr size_t quorum = 2;
+
+std::string RunReplicatedWrite(size_t slowReplicas) {
+    ClosedPipeLine pipeline(GetEngine()->GetBackbuffer());
+    auto* replicatedWrite = SetupReplicatedWriteModel(pipeline, replicas, quorum, slowReplicas);
+
+    while (Now() < simulatedTime) {
+        AdvanceTime(tickInterval);
+        pipeline.Tick(tickInterval);
+    }
+
+    auto stragglerLagUs = replicatedWrite->GetStragglerLagUs();
+
+    char header[256];
+    snprintf(header, sizeof(header), "Slow replicas: %ld of %ld, quorum: %ld, straggler lag p50: %d us, p99: %d us\n",
+        slowReplicas, replicas, quorum, stragglerLagUs.GetPercentile(50), stragglerLagUs.GetPercentile(99));
+
+    std::string text = header;
+    for (size_t i = 0; i < replicas; ++i) {
+        auto replicaTimeUs = replicatedWrite->GetReplicaTimeUs(i);
+        char line[256];
+        snprintf(line, sizeof(line), "Replica %ld: p50: %d us, p99: %d us, late responses: %ld\n",
+            i, replicaTimeUs.GetPercentile(50), replicaTimeUs.GetPercentile(99), replicatedWrite->GetStragglerCount(i));
+        text += line;
+    }
+
+    return text + pipeline.GetStatsText();
+}
+
+void EasyMain() {
+    ResizeScreen(1920, 1080);
+
+    std::string text;
+    for (size_t slowReplicas = 0; slowReplicas <= replicas; ++slowReplicas) {
+        // clock and event counter are per thread, so each run starts from scratch
+        std::string stats;
+        std::thread([&] { stats = RunReplicatedWrite(slowReplicas); }).join();
+
+        printf("%s\n\n", stats.c_str());
+        fflush(stdout);
+        text += stats + "\n\n";
+    }
+
+    while (!IsKeyDownward(kKeyEscape)) {
+        Clear(BackgroundColor);
+        GetFont().Draw(GetEngine()->GetBackbuffer(), text.c_str(), 10, 200);
+        ShowFrame();
+    }
+}